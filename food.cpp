@@ -1,6 +1,8 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <string_view>
+#include <optional>
 #include <vector>
 #include <unordered_map>
 #include <algorithm>
@@ -13,6 +15,33 @@
 #include <iomanip>
 #include <chrono>
 #include <limits>
+#include <random>
+#include <iterator>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <list>
+#include <functional>
+#include <set>
+#include <numeric>
+#include <unordered_set>
+#include <filesystem>
+
+#include <condition_variable>
+#include <deque>
+#include <csignal>
+#include <charconv>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "json.hpp"
 
@@ -38,7 +67,446 @@ enum class ActivityLevel
 enum class CalorieCalculationMethod
 {
     HARRIS_BENEDICT,
-    MIFFLIN_ST_JEOR
+    MIFFLIN_ST_JEOR,
+    KATCH_MCARDLE,
+    CUNNINGHAM,
+    HARRIS_BENEDICT_REVISED
+};
+
+// Values are stored as ints in profile files, so new methods go at the end
+const int CALCULATION_METHOD_COUNT = 5;
+
+bool parseCalculationMethod(int value, CalorieCalculationMethod &method)
+{
+    if (value < 0 || value >= CALCULATION_METHOD_COUNT)
+    {
+        return false;
+    }
+    method = static_cast<CalorieCalculationMethod>(value);
+    return true;
+}
+
+enum class OutputFormat
+{
+    TABLE,
+    TSV,
+    JSON
+};
+
+bool parseOutputFormat(const string &name, OutputFormat &format)
+{
+    if (name == "table")
+        format = OutputFormat::TABLE;
+    else if (name == "tsv")
+        format = OutputFormat::TSV;
+    else if (name == "json")
+        format = OutputFormat::JSON;
+    else
+        return false;
+    return true;
+}
+
+// Formats a listing into one buffer that is written out in large blocks and
+// flushed once, rather than flushing every line. In table format callers write
+// their human-readable layout with << and field(); numbers come out as iostream
+// would print them. TSV (with a header line) and JSON (an array of objects keyed
+// by column) are built from row(), with numbers in the shortest form that reads
+// back exactly. Every format goes to one ostream, output() unless one is given,
+// so a listing never interleaves with text written to the same stream.
+class ListingRenderer
+{
+private:
+    static const size_t flushBytes = 1 << 16;
+
+    OutputFormat format;
+    vector<string> columns;
+    ostream &out;
+    string buffer;
+    size_t rows = 0;
+
+    static ostream *&defaultOutput()
+    {
+        static ostream *stream = &cout;
+        return stream;
+    }
+
+    void writeOut()
+    {
+        out.write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+
+    void flushIfFull()
+    {
+        if (buffer.size() >= flushBytes)
+            writeOut();
+    }
+
+    template <typename Number>
+    void appendNumber(Number value)
+    {
+        char digits[64];
+        if (format == OutputFormat::TABLE)
+        {
+            buffer.append(digits, snprintf(digits, sizeof(digits), "%g", static_cast<double>(value)));
+        }
+        else if (format == OutputFormat::JSON && !isfinite(static_cast<double>(value)))
+        {
+            buffer += "null";
+        }
+        else
+        {
+            buffer.append(digits, to_chars(digits, digits + sizeof(digits), value).ptr);
+        }
+    }
+
+    void appendText(const string &text)
+    {
+        if (format == OutputFormat::JSON)
+        {
+            buffer += '"';
+            for (char c : text)
+            {
+                switch (c)
+                {
+                case '"': buffer += "\\\""; break;
+                case '\\': buffer += "\\\\"; break;
+                case '\n': buffer += "\\n"; break;
+                case '\r': buffer += "\\r"; break;
+                case '\t': buffer += "\\t"; break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20)
+                    {
+                        char escaped[8];
+                        buffer.append(escaped, snprintf(escaped, sizeof(escaped), "\\u%04x", c));
+                    }
+                    else
+                    {
+                        buffer += c;
+                    }
+                }
+            }
+            buffer += '"';
+            return;
+        }
+        for (char c : text)
+        {
+            switch (c)
+            {
+            case '\\': buffer += "\\\\"; break;
+            case '\n': buffer += "\\n"; break;
+            case '\r': buffer += "\\r"; break;
+            case '\t': buffer += "\\t"; break;
+            default: buffer += c;
+            }
+        }
+    }
+
+    void appendCell(const string &value) { appendText(value); }
+    void appendCell(const char *value) { appendText(value); }
+
+    // A JSON array, or the items joined with commas in TSV
+    void appendCell(const vector<string> &values)
+    {
+        if (format == OutputFormat::JSON)
+            buffer += '[';
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            if (i > 0)
+                buffer += ',';
+            appendText(values[i]);
+        }
+        if (format == OutputFormat::JSON)
+            buffer += ']';
+    }
+
+    template <typename Number, typename = enable_if_t<is_arithmetic_v<Number>>>
+    void appendCell(Number value) { appendNumber(value); }
+
+    template <typename Cell>
+    void appendColumn(size_t column, const Cell &value)
+    {
+        if (format == OutputFormat::JSON)
+        {
+            buffer += column == 0 ? "{" : ",";
+            appendText(columns[column]);
+            buffer += ':';
+        }
+        else if (column > 0)
+        {
+            buffer += '\t';
+        }
+        appendCell(value);
+    }
+
+    void beginRow()
+    {
+        if (format == OutputFormat::JSON)
+            buffer += rows == 0 ? "[" : ",\n";
+        rows++;
+    }
+
+public:
+    // Where listings go by default: cout, unless main has pointed machine-format
+    // listings at stdout while cout carries the prompts to stderr
+    static ostream &output() { return *defaultOutput(); }
+    static void setOutput(ostream &stream) { defaultOutput() = &stream; }
+
+    ListingRenderer(OutputFormat f, vector<string> columnNames, ostream &stream = output())
+        : format(f), columns(move(columnNames)), out(stream)
+    {
+        buffer.reserve(flushBytes + 4096);
+        if (format == OutputFormat::TSV)
+        {
+            for (size_t i = 0; i < columns.size(); i++)
+            {
+                if (i > 0)
+                    buffer += '\t';
+                buffer += columns[i];
+            }
+            buffer += '\n';
+        }
+    }
+
+    ListingRenderer(const ListingRenderer &) = delete;
+    ListingRenderer &operator=(const ListingRenderer &) = delete;
+
+    ~ListingRenderer()
+    {
+        if (format == OutputFormat::JSON)
+            buffer += rows == 0 ? "[]\n" : "]\n";
+        writeOut();
+        out.flush();
+    }
+
+    bool isTable() const { return format == OutputFormat::TABLE; }
+
+    // One record for TSV or JSON, a value per column
+    template <typename... Cells>
+    void row(const Cells &...cells)
+    {
+        beginRow();
+        size_t column = 0;
+        (appendColumn(column++, cells), ...);
+        buffer += format == OutputFormat::JSON ? "}" : "\n";
+        flushIfFull();
+    }
+
+    // A record that is already a JSON object, for JSON output
+    void row(const json &object)
+    {
+        beginRow();
+        buffer += object.dump();
+        flushIfFull();
+    }
+
+    // Table text
+    ListingRenderer &operator<<(const string &text)
+    {
+        buffer += text;
+        flushIfFull();
+        return *this;
+    }
+    ListingRenderer &operator<<(const char *text) { return *this << string(text); }
+    ListingRenderer &operator<<(char c)
+    {
+        buffer += c;
+        return *this;
+    }
+    template <typename Number, typename = enable_if_t<is_arithmetic_v<Number>>>
+    ListingRenderer &operator<<(Number value)
+    {
+        appendNumber(value);
+        return *this;
+    }
+
+    // Table text padded to width like setw, on the left or the right
+    template <typename Value>
+    ListingRenderer &field(const Value &value, size_t width, bool alignRight = false)
+    {
+        size_t start = buffer.size();
+        *this << value;
+        size_t length = buffer.size() - start;
+        if (length < width)
+            buffer.insert(alignRight ? start : buffer.size(), width - length, ' ');
+        return *this;
+    }
+};
+
+// Timing spans and counters compiled into the load, save and search paths, for
+// the stats command and the --stats exit summary. Collection is off unless
+// enabled; while it is off a span or a counter costs one relaxed load. Figures
+// are relaxed atomics, so RPC workers record them without a lock.
+class Instrumentation
+{
+public:
+    using Clock = chrono::steady_clock;
+
+    enum Span
+    {
+        LOAD_DATABASE,
+        LOAD_LOGS,
+        LOAD_PROFILE,
+        SEARCH,
+        SAVE_DATABASE,
+        SAVE_LOGS,
+        SAVE_PROFILE,
+        SPAN_COUNT
+    };
+
+    enum Counter
+    {
+        FOODS_PARSED,
+        DIARY_ENTRIES_PARSED,
+        PROFILE_DAYS_PARSED,
+        BYTES_READ,
+        BYTES_WRITTEN,
+        SEARCH_CANDIDATES,
+        COUNTER_COUNT
+    };
+
+private:
+    struct SpanTotals
+    {
+        atomic<uint64_t> calls{0};
+        atomic<uint64_t> totalNanos{0};
+        atomic<uint64_t> maxNanos{0};
+    };
+
+    static atomic<bool> enabled;
+    static SpanTotals spans[SPAN_COUNT];
+    static atomic<uint64_t> counters[COUNTER_COUNT];
+
+    static const char *spanName(int span)
+    {
+        static const char *names[SPAN_COUNT] = {"load_database", "load_logs", "load_profile", "search",
+                                                "save_database", "save_logs", "save_profile"};
+        return names[span];
+    }
+
+    static const char *counterName(int counter)
+    {
+        static const char *names[COUNTER_COUNT] = {"foods_parsed", "diary_entries_parsed", "profile_days_parsed",
+                                                   "bytes_read", "bytes_written", "search_candidates"};
+        return names[counter];
+    }
+
+    static string millis(uint64_t nanos)
+    {
+        char text[32];
+        snprintf(text, sizeof(text), "%.3f", nanos / 1e6);
+        return text;
+    }
+
+public:
+    static void enable(bool on) { enabled.store(on, memory_order_relaxed); }
+    static bool isEnabled() { return enabled.load(memory_order_relaxed); }
+
+    static void count(Counter counter, uint64_t amount)
+    {
+        if (isEnabled())
+            counters[counter].fetch_add(amount, memory_order_relaxed);
+    }
+
+    // Counts a whole file that was just read or written
+    static void countFile(Counter counter, const string &path)
+    {
+        if (!isEnabled())
+            return;
+        error_code ec;
+        uintmax_t size = filesystem::file_size(path, ec);
+        if (!ec)
+            counters[counter].fetch_add(size, memory_order_relaxed);
+    }
+
+    static void record(Span span, Clock::duration elapsed)
+    {
+        uint64_t nanos = chrono::duration_cast<chrono::nanoseconds>(elapsed).count();
+        SpanTotals &totals = spans[span];
+        totals.calls.fetch_add(1, memory_order_relaxed);
+        totals.totalNanos.fetch_add(nanos, memory_order_relaxed);
+        uint64_t longest = totals.maxNanos.load(memory_order_relaxed);
+        while (nanos > longest && !totals.maxNanos.compare_exchange_weak(longest, nanos, memory_order_relaxed))
+        {
+        }
+    }
+
+    // Table output lists the spans that ran and every counter; TSV and JSON give
+    // one metric per row, e.g. load_database.total_ms or bytes_read
+    static void report(OutputFormat format, ostream &stream = ListingRenderer::output())
+    {
+        ListingRenderer out(format, {"metric", "value"}, stream);
+        if (out.isTable())
+        {
+            out << "\n=== Performance Stats ===\n";
+            out.field("Span", 16).field("Calls", 8, true).field("Total ms", 12, true)
+                .field("Mean ms", 12, true).field("Max ms", 12, true) << '\n';
+        }
+        for (int span = 0; span < SPAN_COUNT; span++)
+        {
+            uint64_t calls = spans[span].calls.load(memory_order_relaxed);
+            uint64_t total = spans[span].totalNanos.load(memory_order_relaxed);
+            uint64_t longest = spans[span].maxNanos.load(memory_order_relaxed);
+            string name = spanName(span);
+            if (!out.isTable())
+            {
+                out.row(name + ".calls", calls);
+                out.row(name + ".total_ms", total / 1e6);
+                out.row(name + ".max_ms", longest / 1e6);
+            }
+            else if (calls > 0)
+            {
+                out.field(name, 16).field(to_string(calls), 8, true).field(millis(total), 12, true)
+                    .field(millis(total / calls), 12, true).field(millis(longest), 12, true) << '\n';
+            }
+        }
+        if (out.isTable())
+        {
+            out << '\n';
+            out.field("Counter", 24).field("Value", 16, true) << '\n';
+        }
+        for (int counter = 0; counter < COUNTER_COUNT; counter++)
+        {
+            uint64_t value = counters[counter].load(memory_order_relaxed);
+            if (out.isTable())
+                out.field(counterName(counter), 24).field(to_string(value), 16, true) << '\n';
+            else
+                out.row(counterName(counter), value);
+        }
+        if (out.isTable())
+        {
+            out << "=========================\n";
+        }
+    }
+};
+
+atomic<bool> Instrumentation::enabled{false};
+Instrumentation::SpanTotals Instrumentation::spans[Instrumentation::SPAN_COUNT];
+atomic<uint64_t> Instrumentation::counters[Instrumentation::COUNTER_COUNT];
+
+// Times its scope into a span, if collection was on when it started
+class ScopedTimer
+{
+private:
+    Instrumentation::Span span;
+    bool active;
+    Instrumentation::Clock::time_point start;
+
+public:
+    explicit ScopedTimer(Instrumentation::Span s) : span(s), active(Instrumentation::isEnabled())
+    {
+        if (active)
+            start = Instrumentation::Clock::now();
+    }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+    ~ScopedTimer()
+    {
+        if (active)
+            Instrumentation::record(span, Instrumentation::Clock::now() - start);
+    }
 };
 
 class Food;
@@ -75,20 +543,39 @@ public:
         return j;
     }
 
-    virtual void display() const
+    // Details as text, a TSV row or the toJson() object
+    void display(OutputFormat format = OutputFormat::TABLE) const
     {
-        cout << "Name: " << name << endl;
-        cout << "Type: " << type << endl;
-        cout << "Calories: " << getCalories() << endl;
-        cout << "Keywords: ";
+        ListingRenderer out(format, {"name", "type", "calories", "keywords", "components"});
+        if (format == OutputFormat::JSON)
+        {
+            out.row(toJson());
+            return;
+        }
+        if (!out.isTable())
+        {
+            out.row(name, type, getCalories(), keywords, componentList());
+            return;
+        }
+
+        out << "Name: " << name << '\n';
+        out << "Type: " << type << '\n';
+        out << "Calories: " << getCalories() << '\n';
+        out << "Keywords: ";
         for (size_t i = 0; i < keywords.size(); ++i)
         {
-            cout << keywords[i];
+            out << keywords[i];
             if (i < keywords.size() - 1)
-                cout << ", ";
+                out << ", ";
         }
-        cout << endl;
+        out << '\n';
+        displayComponents(out);
     }
+
+protected:
+    // "name:servings" for each component, for TSV output
+    virtual vector<string> componentList() const { return {}; }
+    virtual void displayComponents(ListingRenderer &) const {}
 };
 
 // Basic Food class
@@ -102,6 +589,7 @@ public:
         : Food(name, keywords, "basic"), calories(calories) {}
 
     float getCalories() const override { return calories; } // to override getCalories from Food.
+    void setCalories(float c) { calories = c; }
 
     static shared_ptr<BasicFood> fromJson(const json &j)
     {
@@ -134,12 +622,9 @@ class CompositeFood : public Food
 {
 private:
     vector<FoodComponent> components;
+    float calories; // evaluated total, so listings do not walk the components per row
 
-public:
-    CompositeFood(const string &name, const vector<string> &keywords, const vector<FoodComponent> &components)
-        : Food(name, keywords, "composite"), components(components) {}
-
-    float getCalories() const override
+    float sumComponents() const
     {
         float totalCalories = 0.0f;
         for (const auto &component : components)
@@ -149,6 +634,18 @@ public:
         return totalCalories;
     }
 
+public:
+    CompositeFood(const string &name, const vector<string> &keywords, const vector<FoodComponent> &components)
+        : Food(name, keywords, "composite"), components(components), calories(sumComponents()) {}
+
+    const vector<FoodComponent> &getComponents() const { return components; }
+
+    float getCalories() const override { return calories; }
+
+    // Re-evaluates the total after a component's calories changed. Components
+    // that are composites themselves must be refreshed first.
+    void refreshCalories() { calories = sumComponents(); }
+
     json toJson() const override
     {
         json j = Food::toJson();
@@ -163,18 +660,32 @@ public:
         return j;
     }
 
-    void display() const override
+protected:
+    vector<string> componentList() const override
+    {
+        vector<string> list;
+        for (const auto &component : components)
+        {
+            char servings[32];
+            snprintf(servings, sizeof(servings), ":%g", component.servings);
+            list.push_back(component.food->getName() + servings);
+        }
+        return list;
+    }
+
+    void displayComponents(ListingRenderer &out) const override
     {
-        Food::display();
-        cout << "Components:" << endl;
+        out << "Components:\n";
         for (const auto &component : components)
         {
-            cout << "  - " << component.food->getName()
-                 << " (" << component.servings << " serving"
-                 << (component.servings > 1 ? "s" : "") << ")" << endl;
+            out << "  - " << component.food->getName()
+                << " (" << component.servings << " serving"
+                << (component.servings > 1 ? "s" : "") << ")\n";
         }
     }
 
+public:
+
     static shared_ptr<CompositeFood> createFromComponents(
         const string &name,
         const vector<string> &keywords,
@@ -184,1330 +695,7273 @@ public:
     }
 };
 
-// Food Database Manager class
-class FoodDatabaseManager
+// Case-insensitive substring test without allocating; needle must already be lowercase
+inline bool containsIgnoreCase(const string &haystack, const string &lowerNeedle)
 {
-public:
-    map<string, shared_ptr<Food>> foods;
+    if (lowerNeedle.empty())
+        return true;
+    auto it = search(haystack.begin(), haystack.end(), lowerNeedle.begin(), lowerNeedle.end(),
+                     [](char a, char b)
+                     { return static_cast<char>(tolower(static_cast<unsigned char>(a))) == b; });
+    return it != haystack.end();
+}
 
-private:
-    string databaseFilePath;
-    bool modified;
+inline vector<string> toLowerKeywords(const vector<string> &keywords)
+{
+    vector<string> lowerKeywords;
+    lowerKeywords.reserve(keywords.size());
+    for (const auto &keyword : keywords)
+    {
+        string lowerKeyword = keyword;
+        transform(lowerKeyword.begin(), lowerKeyword.end(), lowerKeyword.begin(), ::tolower);
+        lowerKeywords.push_back(lowerKeyword);
+    }
+    return lowerKeywords;
+}
 
-    void clear()
+inline bool hasKeyword(const Food &food, const string &lowerKeyword)
+{
+    for (const auto &foodKeyword : food.getKeywords())
     {
-        foods.clear();
+        if (containsIgnoreCase(foodKeyword, lowerKeyword))
+            return true;
+    }
+    return false;
+}
+
+// Keywords must already be lowercase. Stops at the first miss (matchall) or the
+// first hit (any), so callers should order the keywords accordingly.
+inline bool matchesKeywords(const Food &food, const vector<string> &lowerKeywords, bool matchall)
+{
+    for (const auto &lowerKeyword : lowerKeywords)
+    {
+        if (hasKeyword(food, lowerKeyword) != matchall)
+            return !matchall;
     }
+    return matchall;
+}
+
+// Non-owning handle to a food stored in the catalog. Copying it does not touch
+// the shared_ptr reference count; share() does when an owner is really needed.
+class FoodHandle
+{
+private:
+    const shared_ptr<Food> *slot;
 
 public:
-    FoodDatabaseManager(const string &filePath = "food_database.json")
-        : databaseFilePath(filePath), modified(false) {}
+    explicit FoodHandle(const shared_ptr<Food> *s = nullptr) : slot(s) {}
 
-    bool loadDatabase()
+    const Food &operator*() const { return **slot; }
+    const Food *operator->() const { return slot->get(); }
+    explicit operator bool() const { return slot != nullptr; }
+
+    shared_ptr<Food> share() const { return slot ? *slot : nullptr; }
+};
+
+// Position of a food inside the catalog map; stable for the lifetime of the entry
+using FoodSlot = const shared_ptr<Food> *;
+
+// Uniform access to the catalog slot behind an iterator, whether it walks a
+// map<..., shared_ptr<Food>> or a vector of FoodSlots
+template <typename MapIterator>
+auto catalogSlot(const MapIterator &it) -> decltype(&it->second)
+{
+    return &it->second;
+}
+
+inline FoodSlot catalogSlot(const vector<FoodSlot>::const_iterator &it)
+{
+    return *it;
+}
+
+// Lazily evaluated keyword query over a range of catalog entries (a map whose
+// values are shared_ptr<Food>, or a vector of FoodSlots). Foods are matched only as
+// iteration reaches them, so an unconsumed result set costs nothing. An empty
+// keyword list matches all.
+template <typename MapIterator>
+class FoodQueryRange
+{
+public:
+    static constexpr size_t unlimited = numeric_limits<size_t>::max();
+
+private:
+    MapIterator first, last;
+    vector<string> lowerKeywords;
+    bool matchall;
+    size_t offset;
+    size_t limit;
+    shared_ptr<const void> keepAlive; // owns planned candidates when the range walks them
+
+    bool accepts(const Food &food) const
     {
-        clear();
+        return lowerKeywords.empty() || matchesKeywords(food, lowerKeywords, matchall);
+    }
 
-        ifstream file(databaseFilePath);
-        if (!file.is_open())
+public:
+    class iterator
+    {
+    private:
+        MapIterator current, last;
+        const FoodQueryRange *range;
+        size_t remaining;
+
+        // Candidates examined are tallied locally and counted once per result
+        void seek()
         {
-            cout << "No existing database found. Starting with empty database." << endl;
-            return false;
+            size_t examined = 0;
+            while (current != last && !range->accepts(**catalogSlot(current)))
+            {
+                ++current;
+                ++examined;
+            }
+            Instrumentation::count(Instrumentation::SEARCH_CANDIDATES, examined + (current != last));
         }
 
-        try
-        {
-            json j;
-            file >> j;
+        friend class FoodQueryRange;
 
-            // Store the entire JSON data for each food
-            map<string, json> pendingFoods;
+    public:
+        using iterator_category = forward_iterator_tag;
+        using value_type = FoodHandle;
+        using difference_type = ptrdiff_t;
+        using pointer = const FoodHandle *;
+        using reference = FoodHandle;
 
-            // First pass: load all basic foods and catalogue composite foods
-            for (const auto &foodJson : j)
-            {
-                string type = foodJson["type"];
-                string name = foodJson["name"];
+        iterator(MapIterator cur, MapIterator end, const FoodQueryRange *r, size_t rem)
+            : current(cur), last(end), range(r), remaining(rem) {}
 
-                if (type == "basic")
-                {
-                    foods[name] = BasicFood::fromJson(foodJson);
-                }
-                else if (type == "composite")
-                {
-                    pendingFoods[name] = foodJson;
-                }
-            }
+        FoodHandle operator*() const { return FoodHandle(catalogSlot(current)); }
 
-            // Function to recursively load a composite food and its dependencies
-            function<shared_ptr<Food>(const string &)> loadCompositeFood = [&](const string &name) -> shared_ptr<Food>
-            {
-                // If already loaded, return it
-                if (foods.find(name) != foods.end())
-                {
-                    return foods[name];
-                }
+        iterator &operator++()
+        {
+            ++current;
+            if (remaining != unlimited && --remaining == 0)
+                current = last;
+            else
+                seek();
+            return *this;
+        }
 
-                // If not a pending composite food, can't load it
-                if (pendingFoods.find(name) == pendingFoods.end())
-                {
-                    cout << "Warning: Food '" << name << "' not found." << endl;
-                    return nullptr;
-                }
+        bool operator==(const iterator &other) const { return current == other.current; }
+        bool operator!=(const iterator &other) const { return current != other.current; }
+    };
 
-                // Get the food's JSON
-                json foodJson = pendingFoods[name];
+    FoodQueryRange(MapIterator f, MapIterator l, const vector<string> &keywords, bool all,
+                   size_t off = 0, size_t lim = unlimited)
+        : first(f), last(l), lowerKeywords(toLowerKeywords(keywords)), matchall(all), offset(off), limit(lim) {}
 
-                // Load all components
-                vector<FoodComponent> components;
-                for (const auto &componentJson : foodJson["components"])
-                {
-                    string componentName = componentJson["name"];
-                    float servings = componentJson["servings"];
+    // Range over candidates that were already matched exactly, e.g. by the query planner
+    explicit FoodQueryRange(shared_ptr<const vector<FoodSlot>> candidates)
+        : first(candidates->begin()), last(candidates->end()), matchall(false),
+          offset(0), limit(unlimited), keepAlive(move(candidates)) {}
 
-                    // Recursively load component if needed
-                    shared_ptr<Food> componentFood;
-                    if (foods.find(componentName) != foods.end())
-                    {
-                        componentFood = foods[componentName];
-                    }
-                    else
-                    {
-                        componentFood = loadCompositeFood(componentName);
-                    }
+    iterator begin() const
+    {
+        iterator it(first, last, this, unlimited);
+        it.seek();
+        for (size_t skipped = 0; skipped < offset && it.current != last; ++skipped)
+            ++it;
+        it.remaining = limit;
+        if (limit == 0)
+            it.current = last;
+        return it;
+    }
 
-                    if (componentFood)
-                    {
-                        components.emplace_back(componentFood, servings);
-                    }
-                    else
-                    {
-                        cout << "Warning: Component '" << componentName
-                             << "' not found for composite food '" << name << "'" << endl;
-                    }
-                }
+    iterator end() const { return iterator(last, last, this, 0); }
 
-                // Create the composite food
-                vector<string> keywords = foodJson["keywords"].get<vector<string>>();
-                shared_ptr<Food> food = make_shared<CompositeFood>(name, keywords, components);
+    bool empty() const { return begin() == end(); }
 
-                // Add it to loaded foods
-                foods[name] = food;
+    // Sub-range of at most lim results starting off results into this one
+    FoodQueryRange page(size_t off, size_t lim) const
+    {
+        FoodQueryRange result = *this;
+        result.offset = offset + off;
+        if (limit == unlimited)
+            result.limit = lim;
+        else
+            result.limit = off >= limit ? 0 : min(lim, limit - off);
+        return result;
+    }
+};
 
-                return food;
-            };
+// One keyword of a planned search, in evaluation order
+struct KeywordPlanStep
+{
+    string keyword;
+    size_t documentFrequency; // foods carrying a matching keyword (upper bound when several terms match)
+    size_t postingLists;      // vocabulary terms containing the keyword
+    size_t candidatesAfter;   // candidates left after this step
+};
 
-            // Second pass: load all composite foods with dependencies
-            for (const auto &[name, _] : pendingFoods)
-            {
-                loadCompositeFood(name);
-            }
+// Execution plan and cost counters of a keyword search, for explain mode
+struct SearchPlan
+{
+    bool matchall = false;
+    size_t catalogSize = 0;
+    size_t vocabularySize = 0;
+    vector<KeywordPlanStep> steps;
+    size_t postingsRead = 0;
+    size_t membershipProbes = 0;
+    bool shortCircuited = false;
+
+    // Keyword checks a full catalog scan would perform
+    size_t naiveCost() const { return catalogSize * steps.size(); }
+    size_t cost() const { return postingsRead + membershipProbes; }
+};
 
-            cout << "Database loaded: " << foods.size() << " foods." << endl;
-            return true;
+// Buffered CSV output. Rows are formatted into a fixed-size buffer that goes to
+// the file whenever it fills, so memory use does not grow with the export.
+class CsvWriter
+{
+private:
+    ofstream file;
+    string buffer;
+    bool rowStarted;
+    static const size_t flushBytes = 1 << 16;
+
+    void separate()
+    {
+        if (rowStarted)
+            buffer += ',';
+        rowStarted = true;
+    }
+
+public:
+    explicit CsvWriter(const string &path) : file(path, ios::binary | ios::trunc), rowStarted(false)
+    {
+        buffer.reserve(flushBytes + 1024);
+    }
+
+    bool isOpen() const { return file.is_open(); }
+
+    // Quotes the value when it holds a comma, quote or line break
+    CsvWriter &field(const string &value)
+    {
+        separate();
+        if (value.find_first_of(",\"\r\n") == string::npos)
+        {
+            buffer += value;
+            return *this;
         }
-        catch (const exception &e)
+        buffer += '"';
+        for (char c : value)
         {
-            cout << "Error loading database: " << e.what() << endl;
-            return false;
+            if (c == '"')
+                buffer += '"';
+            buffer += c;
         }
+        buffer += '"';
+        return *this;
     }
 
-    bool saveDatabase()
+    CsvWriter &field(double value)
     {
-        try
+        separate();
+        char text[32];
+        int length = snprintf(text, sizeof(text), "%.15g", value);
+        buffer.append(text, length);
+        return *this;
+    }
+
+    void endRow()
+    {
+        buffer += '\n';
+        rowStarted = false;
+        if (buffer.size() >= flushBytes)
         {
-            json j = json::array();
+            file.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
 
-            for (const auto &[name, food] : foods)
-            {
-                j.push_back(food->toJson());
-            }
+    bool close()
+    {
+        file.write(buffer.data(), buffer.size());
+        buffer.clear();
+        file.close();
+        return !file.fail();
+    }
+};
 
-            ofstream file(databaseFilePath);
-            if (!file.is_open())
-            {
-                cout << "Error: Unable to open file for writing." << endl;
-                return false;
-            }
+// Writer for the columnar export format (".dcol"). Rows are buffered per column
+// and written out in blocks, so memory is bounded by one block.
+//
+//   file   := "DCOL" u8(version = 1) varint(columns) column* block* varint(0)
+//   column := varint(name length) name u8(type: 0 day number, 1 dictionary string,
+//             2 double, 3 string)
+//   block  := varint(rows) { u8(encoding) varint(payload bytes) payload } per column
+//
+// Every column is compressed on its own:
+//   day number  (encoding 0) zigzag varint deltas, starting from 0 in each block
+//   dictionary  (encoding 1) varint(new strings) strings, then a varint id per row;
+//                            ids index the strings of all blocks so far
+//   double      (encoding 2) zigzag varint deltas of value * 1000 when that scale
+//                            is exact for the whole block
+//               (encoding 3) raw little-endian IEEE-754 otherwise
+//   string      (encoding 4) varint length and bytes per row
+class ColumnarWriter
+{
+public:
+    enum class ColumnType : uint8_t
+    {
+        DAY,
+        DICTIONARY,
+        DOUBLE,
+        STRING
+    };
 
-            file << j.dump(4); // Pretty print with 4 spaces
-            file.close();
+private:
+    struct Column
+    {
+        string name;
+        ColumnType type;
+        vector<int64_t> integers; // day numbers or dictionary ids
+        vector<double> doubles;
+        vector<string> strings;   // STRING values, or the dictionary strings new in this block
+        unordered_map<string, uint32_t> dictionary;
+    };
 
-            modified = false;
-            cout << "Database saved to " << databaseFilePath << endl;
-            return true;
-        }
-        catch (const exception &e)
+    ofstream file;
+    vector<Column> columns;
+    size_t blockRows;
+    size_t pendingRows;
+    size_t totalRows;
+    string payload;
+    string block;
+
+    static void putVarint(string &out, uint64_t value)
+    {
+        while (value >= 0x80)
         {
-            cout << "Error saving database: " << e.what() << endl;
-            return false;
+            out += static_cast<char>((value & 0x7f) | 0x80);
+            value >>= 7;
         }
+        out += static_cast<char>(value);
     }
 
-    bool addFood(shared_ptr<Food> food)
+    static uint64_t zigzag(int64_t value)
     {
-        string name = food->getName();
-        if (foods.find(name) != foods.end())
+        return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    static void putString(string &out, const string &value)
+    {
+        putVarint(out, value.size());
+        out += value;
+    }
+
+    static void putDeltas(string &out, const vector<int64_t> &values)
+    {
+        int64_t previous = 0;
+        for (int64_t value : values)
         {
-            cout << "Error: A food with name '" << name << "' already exists." << endl;
-            return false;
+            putVarint(out, zigzag(value - previous));
+            previous = value;
         }
-
-        foods[name] = food;
-        modified = true;
-        return true;
     }
 
-    vector<shared_ptr<Food>> searchFoodsByKeywords(const vector<string> &keywords, bool matchall)
+    // Picks the scaled-integer encoding when every value round-trips through it
+    static uint8_t encodeDoubles(string &out, const vector<double> &values)
     {
-        vector<shared_ptr<Food>> results;
-        // if matchall is there, we need foods with all keywords, else food which atleast one keyword
-        for (const auto &[name, food] : foods)
+        vector<int64_t> scaled;
+        scaled.reserve(values.size());
+        for (double value : values)
         {
-            int cnt = 0;
-            for (auto &keyword : keywords)
+            double milli = nearbyint(value * 1000.0);
+            if (!(abs(milli) < 9.0e15) || milli / 1000.0 != value)
             {
-                string lowerKeyword = keyword;
-                transform(lowerKeyword.begin(), lowerKeyword.end(), lowerKeyword.begin(), ::tolower);
-                for (const auto &foodKeyword : food->getKeywords())
+                for (double raw : values)
                 {
-                    string lowerFoodKeyword = foodKeyword;
-                    transform(lowerFoodKeyword.begin(), lowerFoodKeyword.end(), lowerFoodKeyword.begin(), ::tolower);
-                    if (lowerFoodKeyword.find(lowerKeyword) != string::npos)
-                    {
-                        cnt++;
-                        break;
-                    }
+                    uint64_t bits;
+                    memcpy(&bits, &raw, sizeof(bits));
+                    for (int shift = 0; shift < 64; shift += 8)
+                        out += static_cast<char>(bits >> shift);
                 }
+                return 3;
             }
-            if (matchall && cnt == keywords.size())
-            {
-                results.push_back(food);
-            }
-            else if (!matchall && cnt > 0)
+            scaled.push_back(static_cast<int64_t>(milli));
+        }
+        putDeltas(out, scaled);
+        return 2;
+    }
+
+    bool writeBlock()
+    {
+        block.clear();
+        putVarint(block, pendingRows);
+        for (Column &column : columns)
+        {
+            payload.clear();
+            uint8_t encoding = 0;
+            switch (column.type)
             {
-                results.push_back(food);
+            case ColumnType::DAY:
+                putDeltas(payload, column.integers);
+                encoding = 0;
+                break;
+            case ColumnType::DICTIONARY:
+                putVarint(payload, column.strings.size());
+                for (const string &value : column.strings)
+                    putString(payload, value);
+                for (int64_t id : column.integers)
+                    putVarint(payload, static_cast<uint64_t>(id));
+                encoding = 1;
+                break;
+            case ColumnType::DOUBLE:
+                encoding = encodeDoubles(payload, column.doubles);
+                break;
+            case ColumnType::STRING:
+                for (const string &value : column.strings)
+                    putString(payload, value);
+                encoding = 4;
+                break;
             }
+            block += static_cast<char>(encoding);
+            putVarint(block, payload.size());
+            block += payload;
+
+            column.integers.clear();
+            column.doubles.clear();
+            column.strings.clear();
         }
-        return results;
+        file.write(block.data(), block.size());
+        pendingRows = 0;
+        return !file.fail();
     }
 
-    shared_ptr<Food> getFood(const string &name)
+public:
+    ColumnarWriter(const string &path, const vector<pair<string, ColumnType>> &schema, size_t rowsPerBlock = 65536)
+        : file(path, ios::binary | ios::trunc), blockRows(rowsPerBlock), pendingRows(0), totalRows(0)
     {
-        auto it = foods.find(name);
-        if (it != foods.end())
+        string header = "DCOL";
+        header += static_cast<char>(1);
+        putVarint(header, schema.size());
+        for (const auto &[name, type] : schema)
         {
-            return it->second;
+            putString(header, name);
+            header += static_cast<char>(type);
+            columns.push_back(Column{name, type, {}, {}, {}, {}});
         }
-        return nullptr;
+        file.write(header.data(), header.size());
     }
 
-    void listAllFoods() const
+    bool isOpen() const { return file.is_open(); }
+    size_t rows() const { return totalRows; }
+
+    void add(size_t column, int32_t dayNumber) { columns[column].integers.push_back(dayNumber); }
+    void add(size_t column, double value) { columns[column].doubles.push_back(value); }
+
+    void add(size_t column, const string &value)
     {
-        cout << "\n=== All Foods in Database (" << foods.size() << ") ===" << endl;
-        for (const auto &[name, food] : foods)
+        Column &target = columns[column];
+        if (target.type == ColumnType::STRING)
         {
-            cout << name << " (" << food->getType() << ") - " << food->getCalories() << " calories" << endl;
+            target.strings.push_back(value);
+            return;
         }
-        cout << "===========================" << endl;
+        auto [it, inserted] = target.dictionary.emplace(value, static_cast<uint32_t>(target.dictionary.size()));
+        if (inserted)
+            target.strings.push_back(value);
+        target.integers.push_back(it->second);
     }
 
-    bool isModified() const
+    void endRow()
     {
-        return modified;
+        pendingRows++;
+        totalRows++;
+        if (pendingRows == blockRows)
+            writeBlock();
     }
-};
-
-// Food log entry for a specific day
-class FoodEntry
-{
-public:
-    string foodName;
-    double servings;
-    double calories;
 
-    FoodEntry(const string &name, double servs, double cals)
-        : foodName(name), servings(servs), calories(cals) {}
+    bool close()
+    {
+        if (pendingRows > 0)
+            writeBlock();
+        string end;
+        putVarint(end, 0);
+        file.write(end.data(), end.size());
+        file.close();
+        return !file.fail();
+    }
 };
 
-// Date handling utility
-class DateUtil
+// Reader for the ".dcol" files ColumnarWriter produces. Decodes one block at a
+// time into rows of JSON values in column order: day numbers and doubles as
+// numbers, dictionary and plain strings as strings.
+class ColumnarReader
 {
 public:
-    static string getCurrentDate()
+    using ColumnType = ColumnarWriter::ColumnType;
+
+private:
+    struct Column
     {
-        auto now = chrono::system_clock::now();
-        auto time = chrono::system_clock::to_time_t(now);
-        tm tm = *localtime(&time);
+        string name;
+        ColumnType type;
+        vector<string> dictionary; // strings of every block read so far
+    };
 
-        stringstream ss;
-        ss << put_time(&tm, "%Y-%m-%d");
-        return ss.str();
-    }
+    ifstream file;
+    vector<Column> columns;
+    bool valid = false;
 
-    static bool isValidDate(const string &dateStr)
+    static bool getVarint(const string &in, size_t &pos, uint64_t &value)
     {
-        if (dateStr.length() != 10)
-            return false;
-
-        // Check format: YYYY-MM-DD
-        for (int i = 0; i < 10; i++)
+        value = 0;
+        for (int shift = 0; shift < 64 && pos < in.size(); shift += 7)
         {
-            if ((i == 4 || i == 7) && dateStr[i] != '-')
-                return false;
-            else if (i != 4 && i != 7 && !isdigit(dateStr[i]))
-                return false;
+            uint8_t byte = static_cast<uint8_t>(in[pos++]);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return true;
         }
+        return false;
+    }
 
-        int year = stoi(dateStr.substr(0, 4));
-        int month = stoi(dateStr.substr(5, 2));
-        int day = stoi(dateStr.substr(8, 2));
-
-        if (month < 1 || month > 12)
-            return false;
-
-        int daysInMonth[] = {0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-
-        // Adjust for leap year
-        if (month == 2 && ((year % 4 == 0 && year % 100 != 0) || year % 400 == 0))
+    bool getVarint(uint64_t &value)
+    {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
         {
-            daysInMonth[2] = 29;
+            int byte = file.get();
+            if (byte == ifstream::traits_type::eof())
+                return false;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return true;
         }
-
-        return day >= 1 && day <= daysInMonth[month];
+        return false;
     }
-};
-
-// Command interface for undo functionality
-class Command
-{
-public:
-    virtual ~Command() = default;
-    virtual void execute() = 0;
-    virtual void undo() = 0;
-    virtual string getDescription() const = 0;
-};
-
-// Food diary main class
-class FoodDiary
-{
-private:
-    string logFile;
-    map<string, vector<FoodEntry>> dailyLogs;
-    stack<shared_ptr<Command>> undoStack;
-    string currentDate;
-    FoodDatabaseManager &dbManager;
 
-public:
-    FoodDiary(FoodDatabaseManager &db, const string &log)
-        : dbManager(db), logFile(log), currentDate(DateUtil::getCurrentDate())
+    static int64_t unzigzag(uint64_t value)
     {
-        loadLogs();
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
     }
 
-    ~FoodDiary()
+    static bool getString(const string &in, size_t &pos, string &value)
     {
-        saveLogs();
+        uint64_t length;
+        if (!getVarint(in, pos, length) || length > in.size() - pos)
+            return false;
+        value = in.substr(pos, length);
+        pos += length;
+        return true;
     }
 
-    // Log operations
-    void loadLogs()
+    // Appends one column's values, decoded from its block payload, to the rows
+    static bool decode(Column &column, uint8_t encoding, const string &payload, vector<json> &rows)
     {
-        try
+        size_t pos = 0;
+        uint64_t raw;
+        int64_t previous = 0;
+        switch (encoding)
         {
-            ifstream file(logFile);
-            if (!file.is_open())
+        case 0: // day number deltas
+        case 2: // deltas of value * 1000
+            for (json &row : rows)
             {
-                cout << "No existing log file found. Creating a new one." << endl;
-                return;
+                if (!getVarint(payload, pos, raw))
+                    return false;
+                previous += unzigzag(raw);
+                row.push_back(encoding == 0 ? json(previous) : json(previous / 1000.0));
             }
-
-            json j;
-            file >> j;
-            file.close();
-
-            for (auto &[date, entries] : j.items())
+            break;
+        case 1:
+        {
+            uint64_t added;
+            if (!getVarint(payload, pos, added))
+                return false;
+            for (; added > 0; added--)
             {
-                for (const auto &entry : entries)
-                {
-                    string foodName = entry["food"];
-                    double servings = entry["servings"];
-                    double calories = entry["calories"];
-                    dailyLogs[date].emplace_back(foodName, servings, calories);
-                }
+                string value;
+                if (!getString(payload, pos, value))
+                    return false;
+                column.dictionary.push_back(move(value));
             }
-
-            cout << "Loaded food logs for " << dailyLogs.size() << " days." << endl;
+            for (json &row : rows)
+            {
+                if (!getVarint(payload, pos, raw) || raw >= column.dictionary.size())
+                    return false;
+                row.push_back(column.dictionary[raw]);
+            }
+            break;
         }
-        catch (const exception &e)
-        {
-            cerr << "Error loading logs: " << e.what() << endl;
+        case 3:
+            for (json &row : rows)
+            {
+                if (payload.size() - pos < sizeof(uint64_t))
+                    return false;
+                uint64_t bits = 0;
+                for (int shift = 0; shift < 64; shift += 8)
+                    bits |= static_cast<uint64_t>(static_cast<uint8_t>(payload[pos++])) << shift;
+                double value;
+                memcpy(&value, &bits, sizeof(value));
+                row.push_back(value);
+            }
+            break;
+        case 4:
+            for (json &row : rows)
+            {
+                string value;
+                if (!getString(payload, pos, value))
+                    return false;
+                row.push_back(move(value));
+            }
+            break;
+        default:
+            return false;
         }
+        return pos == payload.size();
     }
 
-    void saveLogs()
+public:
+    explicit ColumnarReader(const string &path) : file(path, ios::binary)
     {
-        try
+        char header[5];
+        uint64_t count;
+        if (!file.read(header, sizeof(header)) || string(header, 4) != "DCOL" || header[4] != 1 || !getVarint(count))
+            return;
+        for (; count > 0; count--)
         {
-            json j;
-
-            for (const auto &[date, entries] : dailyLogs)
-            {
-                json dateEntries = json::array();
-
-                for (const auto &entry : entries)
-                {
-                    json entryJson;
-                    entryJson["food"] = entry.foodName;
-                    entryJson["servings"] = entry.servings;
-                    entryJson["calories"] = entry.calories;
-                    dateEntries.push_back(entryJson);
-                }
-
-                j[date] = dateEntries;
-            }
-
-            ofstream file(logFile);
-            if (!file.is_open())
-            {
-                cerr << "Unable to open log file for writing: " << logFile << endl;
+            uint64_t length;
+            if (!getVarint(length))
                 return;
-            }
+            string name(length, '\0');
+            int type = file.read(&name[0], length) ? file.get() : -1;
+            if (type < 0 || type > static_cast<int>(ColumnType::STRING))
+                return;
+            columns.push_back(Column{move(name), static_cast<ColumnType>(type), {}});
+        }
+        valid = true;
+    }
 
-            file << setw(4) << j;
-            file.close();
+    // False for a file that is missing, not columnar or damaged
+    bool isValid() const { return valid; }
 
-            cout << "Logs saved successfully." << endl;
-        }
-        catch (const exception &e)
-        {
-            cerr << "Error saving logs: " << e.what() << endl;
-        }
+    vector<string> columnNames() const
+    {
+        vector<string> names;
+        for (const Column &column : columns)
+            names.push_back(column.name);
+        return names;
     }
 
-    // Command to add a food entry
-    class AddFoodCommand : public Command
+    // Decodes the next block into rows, one JSON array per row. Returns false at
+    // the end of the file, and also clears isValid when the file is damaged.
+    bool readBlock(vector<json> &rows)
     {
-    private:
-        FoodDiary &diary;
-        string date;
-        string foodName;
-        double servings;
-        double calories;
+        rows.clear();
+        uint64_t rowCount;
+        if (!valid || !getVarint(rowCount))
+        {
+            valid = false;
+            return false;
+        }
+        if (rowCount == 0)
+            return false;
 
-    public:
-        AddFoodCommand(FoodDiary &d, const string &dt, const string &name, double servs)
-            : diary(d), date(dt), foodName(name), servings(servs)
+        rows.assign(rowCount, json::array());
+        string payload;
+        for (Column &column : columns)
         {
-            // Calculate calories based on food definition
-            // auto it = diary.foods.find(foodName);
-            auto it = diary.dbManager.getFood(foodName);
-            if (it != nullptr)
+            int encoding = file.get();
+            uint64_t size;
+            if (encoding == ifstream::traits_type::eof() || !getVarint(size))
             {
-                calories = it->getCalories() * servings;
+                valid = false;
+                break;
             }
-            else
+            payload.resize(size);
+            if (!file.read(&payload[0], size) || !decode(column, static_cast<uint8_t>(encoding), payload, rows))
             {
-                // cerr << "Food not found: " << foodName << endl;
-                calories = 0;
+                valid = false;
+                break;
             }
         }
+        if (!valid)
+            rows.clear();
+        return valid;
+    }
+};
 
-        void execute() override
-        {
-            diary.dailyLogs[date].emplace_back(foodName, servings, calories);
-        }
+// Export files ending in ".csv" are written as CSV, anything else as columnar
+inline bool isCsvPath(const string &path)
+{
+    return path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+}
+
+// Unsaved-change tracking shared by the catalog, the diary and the profile. Each
+// edit bumps a generation; a save records the generation it captured before
+// writing, so edits that land while it runs leave the store dirty. Edits and
+// saves happen under the store's own lock; the fields are atomic so the
+// autosaver can read them without it.
+class DirtyTracker
+{
+public:
+    using Clock = chrono::steady_clock;
 
-        void undo() override
-        {
-            auto &entries = diary.dailyLogs[date];
-            if (!entries.empty())
-            {
-                // Remove the latest entry with this food name
-                for (auto it = entries.rbegin(); it != entries.rend(); ++it)
-                {
-                    if (it->foodName == foodName && abs(it->servings - servings) < 0.001)
-                    {
-                        entries.erase((it + 1).base());
-                        break;
-                    }
-                }
-            }
+    struct Snapshot
+    {
+        uint64_t generation;
+        Clock::time_point at;
+    };
 
-            // If the daily log is now empty, remove the date entry
-            if (entries.empty())
-            {
-                diary.dailyLogs.erase(date);
-            }
-        }
+private:
+    atomic<uint64_t> generation{0};
+    atomic<uint64_t> savedGeneration{0};
+    atomic<Clock::rep> firstUnsaved{0}; // oldest edit not yet saved
+    atomic<Clock::rep> lastChange{0};
+    function<void()> listener;          // called when the store goes from clean to dirty
 
-        string getDescription() const override
+public:
+    DirtyTracker() = default;
+    DirtyTracker(const DirtyTracker &) = delete;
+    DirtyTracker &operator=(const DirtyTracker &) = delete;
+
+    void setListener(function<void()> fn) { listener = move(fn); }
+
+    void markDirty()
+    {
+        Clock::rep now = Clock::now().time_since_epoch().count();
+        lastChange = now;
+        if (generation++ == savedGeneration)
         {
-            stringstream ss;
-            ss << "Add " << servings << " serving(s) of " << foodName << " ("
-               << calories << " calories) on " << date;
-            return ss.str();
+            firstUnsaved = now;
+            if (listener)
+                listener();
         }
+    }
+
+    bool isDirty() const { return generation != savedGeneration; }
+
+    // Taken before a save starts writing
+    Snapshot beginSave() const { return {generation, Clock::now()}; }
+
+    void markSaved(const Snapshot &saved)
+    {
+        savedGeneration = saved.generation;
+        if (isDirty())
+            firstUnsaved = saved.at.time_since_epoch().count();
+    }
+
+    // When a debounced save of this store is due: `quiet` after its latest edit,
+    // but no later than `maxStale` after its oldest unsaved one
+    Clock::time_point dueAt(Clock::duration quiet, Clock::duration maxStale) const
+    {
+        Clock::time_point last{Clock::duration(lastChange)};
+        Clock::time_point first{Clock::duration(firstUnsaved)};
+        return min(last + quiet, first + maxStale);
+    }
+};
+
+// Debounced background saving of stores with a DirtyTracker. A burst of edits
+// becomes one write once the store has been quiet for `interval`, or `maxStale`
+// after its oldest unsaved edit if the edits keep coming. Saves run on the
+// autosave thread inside withStores, which must hold the lock the edits are made
+// under; watch() and unwatch() are called with that lock held.
+class Autosaver
+{
+public:
+    using Clock = DirtyTracker::Clock;
+    using StoreRunner = function<void(const function<void()> &)>;
+
+private:
+    struct Target
+    {
+        string name;
+        DirtyTracker *dirty;
+        function<void()> save;
+        Clock::time_point retryAt; // after a failed save
     };
 
-    // Command to delete a food entry
-    class DeleteFoodCommand : public Command
+    StoreRunner withStores;
+    Clock::duration interval;
+    Clock::duration maxStale;
+
+    mutex lock; // guards targets, changed and stopping; taken after the store lock
+    condition_variable wakeup;
+    vector<Target> targets;
+    bool changed = false;
+    bool stopping = false;
+    thread worker;
+
+    Clock::time_point dueAt(const Target &target) const
     {
-    private:
-        FoodDiary &diary;
-        string date;
-        size_t index;
-        FoodEntry deletedEntry;
+        return max(target.dirty->dueAt(interval, maxStale), target.retryAt);
+    }
 
-    public:
-        DeleteFoodCommand(FoodDiary &d, const string &dt, size_t idx)
-            : diary(d), date(dt), index(idx),
-              deletedEntry("", 0, 0)
+    void run()
+    {
+        unique_lock<mutex> guard(lock);
+        while (!stopping)
         {
-            // Store the entry for potential undo
-            auto &entries = diary.dailyLogs[date];
-            if (index < entries.size())
+            Clock::time_point due = Clock::time_point::max();
+            for (const Target &target : targets)
             {
-                deletedEntry = entries[index];
+                if (target.dirty->isDirty())
+                    due = min(due, dueAt(target));
             }
-        }
-
-        void execute() override
-        {
-            auto &entries = diary.dailyLogs[date];
-            if (index < entries.size())
+            if (Clock::now() < due)
             {
-                entries.erase(entries.begin() + index);
-                // If the daily log is now empty, remove the date entry
-                if (entries.empty())
-                {
-                    diary.dailyLogs.erase(date);
-                }
+                auto woken = [this]
+                { return stopping || changed; };
+                if (due == Clock::time_point::max())
+                    wakeup.wait(guard, woken);
+                else
+                    wakeup.wait_until(guard, due, woken);
+                changed = false;
+                continue;
             }
-        }
 
-        void undo() override
-        {
-            // Re-add the deleted entry
-            diary.dailyLogs[date].push_back(deletedEntry);
+            guard.unlock();
+            withStores([this]
+                       {
+                           lock_guard<mutex> targetsGuard(lock);
+                           Clock::time_point now = Clock::now();
+                           for (Target &target : targets)
+                           {
+                               if (!target.dirty->isDirty() || dueAt(target) > now)
+                                   continue;
+                               target.save();
+                               if (target.dirty->isDirty())
+                               {
+                                   cerr << "Autosave of the " << target.name << " failed; retrying later" << endl;
+                                   target.retryAt = now + interval;
+                               }
+                           } });
+            guard.lock();
         }
+    }
 
-        string getDescription() const override
-        {
-            stringstream ss;
-            ss << "Delete " << deletedEntry.servings << " serving(s) of "
-               << deletedEntry.foodName << " from " << date;
-            return ss.str();
-        }
-    };
+public:
+    Autosaver(StoreRunner runner, chrono::milliseconds quietInterval, chrono::milliseconds maxStaleness)
+        : withStores(move(runner)), interval(quietInterval), maxStale(max(quietInterval, maxStaleness))
+    {
+        worker = thread([this]
+                        { run(); });
+    }
 
-    // Date management
-    void setCurrentDate(const string &date)
+    // Stops without a final save; owners save on exit as they see fit. Destroy it
+    // while no edits are running, since it detaches from the trackers.
+    ~Autosaver()
     {
-        if (DateUtil::isValidDate(date))
         {
-            currentDate = date;
-            cout << "Current date set to: " << currentDate << endl;
+            lock_guard<mutex> guard(lock);
+            stopping = true;
         }
-        else
+        wakeup.notify_one();
+        worker.join();
+        for (Target &target : targets)
         {
-            cerr << "Invalid date format. Please use YYYY-MM-DD." << endl;
+            target.dirty->setListener(nullptr);
         }
     }
 
-    string getCurrentDate() const
+    Autosaver(const Autosaver &) = delete;
+    Autosaver &operator=(const Autosaver &) = delete;
+
+    void watch(const string &name, DirtyTracker &dirty, function<void()> save)
     {
-        return currentDate;
+        dirty.setListener([this]
+                          {
+                              lock_guard<mutex> guard(lock);
+                              changed = true;
+                              wakeup.notify_one(); });
+        lock_guard<mutex> guard(lock);
+        targets.push_back({name, &dirty, move(save), Clock::time_point()});
+        changed = true; // it may already be dirty
+        wakeup.notify_one();
     }
 
-    // Log display
-    void displayDailyLog(const string &date) const
+    void unwatch(DirtyTracker &dirty)
     {
-        auto it = dailyLogs.find(date);
-        if (it == dailyLogs.end() || it->second.empty())
-        {
-            cout << "No food entries for " << date << endl;
-            return;
-        }
+        dirty.setListener(nullptr);
+        lock_guard<mutex> guard(lock);
+        targets.erase(remove_if(targets.begin(), targets.end(), [&dirty](const Target &target)
+                                { return target.dirty == &dirty; }),
+                      targets.end());
+    }
+};
+
+// Food Database Manager class
+class FoodDatabaseManager
+{
+public:
+    map<string, shared_ptr<Food>> foods;
 
-        double totalCalories = 0.0;
+    using FoodSearchRange = FoodQueryRange<vector<FoodSlot>::const_iterator>;
+    using CalorieSearchRange = FoodQueryRange<multimap<float, shared_ptr<Food>>::const_iterator>;
 
-        cout << "\nFood Log for " << date << ":\n";
-        cout << setw(5) << left << "No."
-             << setw(30) << left << "Food"
-             << setw(15) << left << "Servings"
-             << setw(15) << right << "Calories" << endl;
-        cout << string(65, '-') << endl;
+private:
+    string databaseFilePath;
+    DirtyTracker dirty;
 
-        int count = 1;
-        for (const auto &entry : it->second)
-        {
-            cout << setw(5) << left << count++
-                 << setw(30) << left << entry.foodName
-                 << setw(15) << left << entry.servings
-                 << setw(15) << right << entry.calories << endl;
+    // Secondary index on evaluated calories, so range queries never recompute composites
+    multimap<float, shared_ptr<Food>> calorieIndex;
 
-            totalCalories += entry.calories;
-        }
+    // Inverted index: lowercase keyword -> slots of the foods carrying it, sorted by
+    // address so posting lists can be intersected by binary search. The size of a
+    // list is the keyword's document frequency.
+    map<string, vector<FoodSlot>> keywordPostings;
 
-        cout << string(65, '-') << endl;
-        cout << setw(50) << left << "Total Calories:"
-             << setw(15) << right << totalCalories << endl;
-        cout << endl;
-    }
+    // Catalog slots in name order, the source of browsing and scan-mode searches
+    vector<FoodSlot> catalogOrder;
 
-    // Command execution with undo support
-    void executeCommand(shared_ptr<Command> command)
+    void clear()
     {
-        command->execute();
-        undoStack.push(command);
-        cout << "Executed: " << command->getDescription() << endl;
+        foods.clear();
+        calorieIndex.clear();
+        keywordPostings.clear();
+        catalogOrder.clear();
     }
 
-    void undo()
+    void indexFood(const shared_ptr<Food> &food)
     {
-        if (undoStack.empty())
+        calorieIndex.emplace(food->getCalories(), food);
+
+        FoodSlot slot = &foods.find(food->getName())->second;
+        for (const auto &lowerKeyword : toLowerKeywords(food->getKeywords()))
         {
-            cout << "Nothing to undo." << endl;
-            return;
+            auto &postings = keywordPostings[lowerKeyword];
+            auto pos = lower_bound(postings.begin(), postings.end(), slot);
+            if (pos == postings.end() || *pos != slot)
+            {
+                postings.insert(pos, slot);
+            }
         }
 
-        auto command = undoStack.top();
-        undoStack.pop();
-
-        command->undo();
-        cout << "Undone: " << command->getDescription() << endl;
+        auto pos = lower_bound(catalogOrder.begin(), catalogOrder.end(), food->getName(),
+                               [](FoodSlot a, const string &name)
+                               { return (*a)->getName() < name; });
+        catalogOrder.insert(pos, slot);
     }
 
-    // Food entry management
-    void addFood(const string &date, const string &foodName, double servings)
+    // Posting lists of every vocabulary term containing the keyword (substring match)
+    vector<const vector<FoodSlot> *> postingsFor(const string &lowerKeyword) const
     {
-        auto it = dbManager.getFood(foodName);
-        if (!it)
+        vector<const vector<FoodSlot> *> lists;
+        for (const auto &[term, postings] : keywordPostings)
         {
-            cerr << "Food not found: " << foodName << endl;
-            return;
+            if (term.find(lowerKeyword) != string::npos)
+            {
+                lists.push_back(&postings);
+            }
         }
-
-        auto command = make_shared<AddFoodCommand>(*this, date, foodName, servings);
-        executeCommand(command);
+        return lists;
     }
 
-    void deleteFood(const string &date, size_t index)
+    // Orders keywords so scans decide as early as possible: rarest first when every
+    // keyword must match, most common first when any may
+    vector<string> orderBySelectivity(const vector<string> &keywords, bool matchall) const
     {
-        auto it = dailyLogs.find(date);
-        if (it == dailyLogs.end() || index >= it->second.size())
+        vector<pair<size_t, string>> weighted;
+        for (const auto &lowerKeyword : toLowerKeywords(keywords))
         {
-            cerr << "Invalid food entry index." << endl;
-            return;
+            size_t frequency = 0;
+            for (const auto *postings : postingsFor(lowerKeyword))
+                frequency += postings->size();
+            weighted.emplace_back(frequency, lowerKeyword);
         }
+        stable_sort(weighted.begin(), weighted.end(), [matchall](const auto &a, const auto &b)
+                    { return matchall ? a.first < b.first : a.first > b.first; });
 
-        auto command = make_shared<DeleteFoodCommand>(*this, date, index);
-        executeCommand(command);
+        vector<string> ordered;
+        for (auto &[_, keyword] : weighted)
+            ordered.push_back(move(keyword));
+        return ordered;
     }
 
-    // User interface methods
-    void addFoodToLog()
-    {
-        // First, let the user choose how to select a food
-        cout << "\nSelect food by:\n";
-        cout << "1. Browse all foods\n";
-        cout << "2. Search by keywords\n";
-        cout << "Choice: ";
-
-        int choice;
-        cin >> choice;
-        cin.ignore();
+public:
+    FoodDatabaseManager(const string &filePath = "food_database.json")
+        : databaseFilePath(filePath) {}
 
-        vector<string> foodOptions;
+    bool loadDatabase()
+    {
+        ScopedTimer timer(Instrumentation::LOAD_DATABASE);
+        clear();
 
-        if (choice == 1)
+        ifstream file(databaseFilePath);
+        if (!file.is_open())
         {
-            // List all foods for selection
-            dbManager.listAllFoods();
-
-            // Convert map to vector for indexing
-            for (const auto &[name, food] : dbManager.foods)
-            {
-                foodOptions.push_back(name);
-            }
+            cout << "No existing database found. Starting with empty database." << endl;
+            return false;
         }
-        else if (choice == 2)
-        {
-            cout << "Enter keywords (separated by spaces): ";
-            string keywordInput;
-            getline(cin, keywordInput);
-
-            // Split input into keywords
-            vector<string> keywords;
-            stringstream ss(keywordInput);
-            string keyword;
-            while (ss >> keyword)
-            {
-                keywords.push_back(keyword);
-            }
 
-            if (keywords.empty())
-            {
-                cout << "No keywords provided." << endl;
-                return;
-            }
+        try
+        {
+            json j;
+            file >> j;
+            Instrumentation::countFile(Instrumentation::BYTES_READ, databaseFilePath);
+            Instrumentation::count(Instrumentation::FOODS_PARSED, j.size());
 
-            cout << "Match: 1. All keywords or 2. Any keyword? ";
-            int matchChoice;
-            cin >> matchChoice;
-            cin.ignore();
+            // Store the entire JSON data for each food
+            map<string, json> pendingFoods;
 
-            bool matchAll = (matchChoice == 1);
-            auto vec = dbManager.searchFoodsByKeywords(keywords, matchAll);
-            for (const auto &food : vec)
+            // First pass: load all basic foods and catalogue composite foods
+            for (const auto &foodJson : j)
             {
-                foodOptions.push_back(food->getName());
-            }
+                string type = foodJson["type"];
+                string name = foodJson["name"];
 
-            if (foodOptions.empty())
-            {
-                cout << "No foods match the given keywords." << endl;
-                return;
+                if (type == "basic")
+                {
+                    foods[name] = BasicFood::fromJson(foodJson);
+                }
+                else if (type == "composite")
+                {
+                    pendingFoods[name] = foodJson;
+                }
             }
 
-            // Display the matching foods
-            cout << "\nMatching Foods:\n";
-            for (size_t i = 0; i < foodOptions.size(); i++)
+            // Function to recursively load a composite food and its dependencies
+            function<shared_ptr<Food>(const string &)> loadCompositeFood = [&](const string &name) -> shared_ptr<Food>
             {
-                cout << (i + 1) << ". " << foodOptions[i] << endl;
-            }
-        }
-        else
-        {
-            cout << "Invalid choice." << endl;
-            return;
-        }
-
-        // Let the user select a food
-        if (foodOptions.empty())
-        {
-            cout << "No foods available for selection." << endl;
-            return;
-        }
-
-        cout << "\nSelect food number (1-" << foodOptions.size() << "): ";
-        int foodIndex;
-        cin >> foodIndex;
+                // If already loaded, return it
+                if (foods.find(name) != foods.end())
+                {
+                    return foods[name];
+                }
 
-        if (foodIndex < 1 || foodIndex > static_cast<int>(foodOptions.size()))
-        {
-            cout << "Invalid food selection." << endl;
-            return;
-        }
+                // If not a pending composite food, can't load it
+                if (pendingFoods.find(name) == pendingFoods.end())
+                {
+                    cout << "Warning: Food '" << name << "' not found." << endl;
+                    return nullptr;
+                }
 
-        string selectedFood = foodOptions[foodIndex - 1];
+                // Get the food's JSON
+                json foodJson = pendingFoods[name];
 
-        // Ask for number of servings
-        cout << "Enter number of servings: ";
-        double servings;
-        cin >> servings;
-        cin.ignore();
+                // Load all components
+                vector<FoodComponent> components;
+                for (const auto &componentJson : foodJson["components"])
+                {
+                    string componentName = componentJson["name"];
+                    float servings = componentJson["servings"];
 
-        if (servings <= 0)
+                    // Recursively load component if needed
+                    shared_ptr<Food> componentFood;
+                    if (foods.find(componentName) != foods.end())
+                    {
+                        componentFood = foods[componentName];
+                    }
+                    else
+                    {
+                        componentFood = loadCompositeFood(componentName);
+                    }
+
+                    if (componentFood)
+                    {
+                        components.emplace_back(componentFood, servings);
+                    }
+                    else
+                    {
+                        cout << "Warning: Component '" << componentName
+                             << "' not found for composite food '" << name << "'" << endl;
+                    }
+                }
+
+                // Create the composite food
+                vector<string> keywords = foodJson["keywords"].get<vector<string>>();
+                shared_ptr<Food> food = make_shared<CompositeFood>(name, keywords, components);
+
+                // Add it to loaded foods
+                foods[name] = food;
+
+                return food;
+            };
+
+            // Second pass: load all composite foods with dependencies
+            for (const auto &[name, _] : pendingFoods)
+            {
+                loadCompositeFood(name);
+            }
+
+            // Build the calorie index once every component is resolved
+            for (const auto &[name, food] : foods)
+            {
+                indexFood(food);
+            }
+
+            cout << "Database loaded: " << foods.size() << " foods." << endl;
+            return true;
+        }
+        catch (const exception &e)
+        {
+            cout << "Error loading database: " << e.what() << endl;
+            return false;
+        }
+    }
+
+    // Writes the catalog next to the database file and renames it into place, so
+    // an interrupted save leaves the previous file intact. Quiet saves (autosave)
+    // only report errors.
+    bool saveDatabase(bool quiet = false)
+    {
+        ScopedTimer timer(Instrumentation::SAVE_DATABASE);
+        try
+        {
+            DirtyTracker::Snapshot saving = dirty.beginSave();
+            json j = json::array();
+
+            for (const auto &[name, food] : foods)
+            {
+                j.push_back(food->toJson());
+            }
+
+            string tempPath = databaseFilePath + ".tmp";
+            ofstream file(tempPath);
+            if (!file.is_open())
+            {
+                cout << "Error: Unable to open file for writing." << endl;
+                return false;
+            }
+
+            string text = j.dump(4); // Pretty print with 4 spaces
+            file << text;
+            file.close();
+            if (!file || rename(tempPath.c_str(), databaseFilePath.c_str()) != 0)
+            {
+                cout << "Error: Unable to write " << databaseFilePath << endl;
+                return false;
+            }
+            Instrumentation::count(Instrumentation::BYTES_WRITTEN, text.size());
+
+            dirty.markSaved(saving);
+            if (!quiet)
+            {
+                cout << "Database saved to " << databaseFilePath << endl;
+            }
+            return true;
+        }
+        catch (const exception &e)
+        {
+            cout << "Error saving database: " << e.what() << endl;
+            return false;
+        }
+    }
+
+    // Streams the catalog to CSV or to the columnar format, one food at a time.
+    // Keywords are joined with ';' and components written as name:servings;...
+    bool exportCatalog(const string &path) const
+    {
+        auto joinKeywords = [](const Food &food)
+        {
+            string joined;
+            for (const string &keyword : food.getKeywords())
+                joined += (joined.empty() ? "" : ";") + keyword;
+            return joined;
+        };
+        auto joinComponents = [](const Food &food)
+        {
+            string joined;
+            if (auto composite = dynamic_cast<const CompositeFood *>(&food))
+            {
+                for (const FoodComponent &component : composite->getComponents())
+                {
+                    char servings[32];
+                    snprintf(servings, sizeof(servings), "%g", component.servings);
+                    joined += (joined.empty() ? "" : ";") + component.food->getName() + ":" + servings;
+                }
+            }
+            return joined;
+        };
+
+        if (isCsvPath(path))
+        {
+            CsvWriter writer(path);
+            if (!writer.isOpen())
+            {
+                cout << "Error: Unable to open file for writing." << endl;
+                return false;
+            }
+            writer.field("name").field("type").field("calories").field("keywords").field("components").endRow();
+            for (const auto &[name, food] : foods)
+            {
+                writer.field(name).field(food->getType()).field(food->getCalories());
+                writer.field(joinKeywords(*food)).field(joinComponents(*food)).endRow();
+            }
+            if (!writer.close())
+            {
+                cout << "Error writing " << path << endl;
+                return false;
+            }
+        }
+        else
+        {
+            using Type = ColumnarWriter::ColumnType;
+            ColumnarWriter writer(path, {{"name", Type::STRING}, {"type", Type::DICTIONARY}, {"calories", Type::DOUBLE},
+                                         {"keywords", Type::STRING}, {"components", Type::STRING}});
+            if (!writer.isOpen())
+            {
+                cout << "Error: Unable to open file for writing." << endl;
+                return false;
+            }
+            for (const auto &[name, food] : foods)
+            {
+                writer.add(0, name);
+                writer.add(1, food->getType());
+                writer.add(2, static_cast<double>(food->getCalories()));
+                writer.add(3, joinKeywords(*food));
+                writer.add(4, joinComponents(*food));
+                writer.endRow();
+            }
+            if (!writer.close())
+            {
+                cout << "Error writing " << path << endl;
+                return false;
+            }
+        }
+
+        cout << "Exported " << foods.size() << " foods to " << path << endl;
+        return true;
+    }
+
+    bool addFood(shared_ptr<Food> food)
+    {
+        string name = food->getName();
+        if (foods.find(name) != foods.end())
+        {
+            cout << "Error: A food with name '" << name << "' already exists." << endl;
+            return false;
+        }
+
+        foods[name] = food;
+        indexFood(food);
+        dirty.markDirty();
+        return true;
+    }
+
+    // Changes a basic food's calories. Returns the new per-serving calories of every
+    // food that changed as a result: the food itself and the composites built on it.
+    map<string, double> setBasicFoodCalories(const string &name, float calories)
+    {
+        map<string, double> changed;
+        auto it = foods.find(name);
+        auto basic = it == foods.end() ? nullptr : dynamic_pointer_cast<BasicFood>(it->second);
+        if (!basic)
+        {
+            cout << "Error: '" << name << "' is not a basic food in the database." << endl;
+            return changed;
+        }
+
+        // Composites that use the food, directly or through other composites
+        map<const Food *, bool> affected{{basic.get(), true}};
+        function<bool(const Food *)> dependsOnChange = [&](const Food *food)
+        {
+            auto known = affected.find(food);
+            if (known != affected.end())
+                return known->second;
+            bool depends = false;
+            if (auto composite = dynamic_cast<const CompositeFood *>(food))
+            {
+                for (const FoodComponent &component : composite->getComponents())
+                    depends = dependsOnChange(component.food.get()) || depends;
+            }
+            affected[food] = depends;
+            return depends;
+        };
+
+        vector<shared_ptr<Food>> changedFoods;
+        for (const auto &[foodName, food] : foods)
+        {
+            if (dependsOnChange(food.get()))
+                changedFoods.push_back(food);
+        }
+
+        // Take the old calories out of the index before they change
+        for (const auto &food : changedFoods)
+        {
+            auto range = calorieIndex.equal_range(food->getCalories());
+            for (auto entry = range.first; entry != range.second; ++entry)
+            {
+                if (entry->second == food)
+                {
+                    calorieIndex.erase(entry);
+                    break;
+                }
+            }
+        }
+        basic->setCalories(calories);
+
+        // Composites keep evaluated totals; refresh each after the composites it uses
+        set<const Food *> refreshed;
+        function<void(const shared_ptr<Food> &)> refresh = [&](const shared_ptr<Food> &food)
+        {
+            auto composite = dynamic_pointer_cast<CompositeFood>(food);
+            if (!composite || !refreshed.insert(food.get()).second)
+                return;
+            for (const FoodComponent &component : composite->getComponents())
+            {
+                if (affected[component.food.get()])
+                    refresh(component.food);
+            }
+            composite->refreshCalories();
+        };
+        for (const auto &food : changedFoods)
+        {
+            refresh(food);
+        }
+
+        for (const auto &food : changedFoods)
+        {
+            calorieIndex.emplace(food->getCalories(), food);
+            changed[food->getName()] = food->getCalories();
+        }
+
+        dirty.markDirty();
+        return changed;
+    }
+
+    // Plans a matchall search: keywords are ranked by document frequency, the rarest
+    // one's postings seed the candidates, and the rest are intersected smallest-first,
+    // stopping as soon as no candidate survives. Returns matches in name order.
+    vector<FoodSlot> planSearch(const vector<string> &keywords, SearchPlan *plan = nullptr) const
+    {
+        SearchPlan localPlan;
+        SearchPlan &p = plan ? *plan : localPlan;
+        p.matchall = true;
+        p.catalogSize = foods.size();
+        p.vocabularySize = keywordPostings.size();
+
+        vector<pair<KeywordPlanStep, vector<const vector<FoodSlot> *>>> steps;
+        for (const auto &lowerKeyword : toLowerKeywords(keywords))
+        {
+            auto lists = postingsFor(lowerKeyword);
+            size_t frequency = 0;
+            for (const auto *postings : lists)
+                frequency += postings->size();
+            steps.push_back({KeywordPlanStep{lowerKeyword, frequency, lists.size(), 0}, move(lists)});
+        }
+        stable_sort(steps.begin(), steps.end(), [](const auto &a, const auto &b)
+                    { return a.first.documentFrequency < b.first.documentFrequency; });
+
+        vector<FoodSlot> candidates;
+        for (size_t i = 0; i < steps.size(); i++)
+        {
+            auto &[step, lists] = steps[i];
+            if (i == 0)
+            {
+                for (const auto *postings : lists)
+                {
+                    candidates.insert(candidates.end(), postings->begin(), postings->end());
+                    p.postingsRead += postings->size();
+                }
+                sort(candidates.begin(), candidates.end());
+                candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+            }
+            else if (!candidates.empty())
+            {
+                auto survivor = candidates.begin();
+                for (FoodSlot slot : candidates)
+                {
+                    for (const auto *postings : lists)
+                    {
+                        p.membershipProbes++;
+                        if (binary_search(postings->begin(), postings->end(), slot))
+                        {
+                            *survivor++ = slot;
+                            break;
+                        }
+                    }
+                }
+                candidates.erase(survivor, candidates.end());
+            }
+            else
+            {
+                p.shortCircuited = true;
+            }
+            step.candidatesAfter = candidates.size();
+            p.steps.push_back(step);
+        }
+
+        sort(candidates.begin(), candidates.end(), [](FoodSlot a, FoodSlot b)
+             { return (*a)->getName() < (*b)->getName(); });
+        Instrumentation::count(Instrumentation::SEARCH_CANDIDATES, p.cost());
+        return candidates;
+    }
+
+    // Lazy keyword search in name order; an empty keyword list browses the whole catalog.
+    // matchall queries go through the planner, so only the rarest keyword's candidates
+    // are materialized; any-keyword queries scan the catalog lazily.
+    FoodSearchRange queryFoods(const vector<string> &keywords, bool matchall) const
+    {
+        if (matchall && !keywords.empty())
+        {
+            return FoodSearchRange(make_shared<const vector<FoodSlot>>(planSearch(keywords)));
+        }
+        return FoodSearchRange(catalogOrder.begin(), catalogOrder.end(),
+                               orderBySelectivity(keywords, matchall), matchall);
+    }
+
+    // Lazy keyword search restricted to calories in [minCalories, maxCalories]. Only the
+    // slice of the calorie index inside the range is ever checked against the keywords.
+    // A reversed range, or one with a NaN bound, matches nothing.
+    CalorieSearchRange queryFoods(const vector<string> &keywords, bool matchall,
+                                  float minCalories, float maxCalories) const
+    {
+        if (!(minCalories <= maxCalories))
+        {
+            return CalorieSearchRange(calorieIndex.end(), calorieIndex.end(), {}, matchall);
+        }
+        return CalorieSearchRange(calorieIndex.lower_bound(minCalories),
+                                  calorieIndex.upper_bound(maxCalories),
+                                  orderBySelectivity(keywords, matchall), matchall);
+    }
+
+    // Prints how a keyword search is evaluated and what it costs
+    void explainSearch(const vector<string> &keywords, bool matchall) const
+    {
+        cout << "\n=== Query Plan ===" << endl;
+        if (!matchall)
+        {
+            cout << "Any-keyword search: lazy scan of " << foods.size()
+                 << " foods, keywords checked most common first:" << endl;
+            for (const auto &keyword : orderBySelectivity(keywords, false))
+            {
+                size_t frequency = 0;
+                for (const auto *postings : postingsFor(keyword))
+                    frequency += postings->size();
+                cout << "  '" << keyword << "' (document frequency " << frequency << ")" << endl;
+            }
+            cout << "==================" << endl;
+            return;
+        }
+
+        SearchPlan plan;
+        vector<FoodSlot> results = planSearch(keywords, &plan);
+
+        cout << "All-keyword search over " << plan.catalogSize << " foods, "
+             << plan.vocabularySize << " distinct keywords" << endl;
+        for (size_t i = 0; i < plan.steps.size(); i++)
+        {
+            const auto &step = plan.steps[i];
+            cout << "  " << (i + 1) << ". " << (i == 0 ? "seed with" : "intersect")
+                 << " '" << step.keyword << "' (document frequency " << step.documentFrequency
+                 << ", " << step.postingLists << " posting list" << (step.postingLists == 1 ? "" : "s")
+                 << ") -> " << step.candidatesAfter << " candidates" << endl;
+        }
+        if (plan.shortCircuited)
+        {
+            cout << "  Stopped early: no candidates left." << endl;
+        }
+        cout << "Cost: " << plan.postingsRead << " postings read + " << plan.membershipProbes
+             << " membership probes = " << plan.cost() << " (full scan: " << plan.naiveCost()
+             << " keyword checks)" << endl;
+        cout << "Results: " << results.size() << endl;
+        cout << "==================" << endl;
+    }
+
+    vector<shared_ptr<Food>> searchFoodsByKeywords(const vector<string> &keywords, bool matchall)
+    {
+        ScopedTimer timer(Instrumentation::SEARCH);
+        vector<shared_ptr<Food>> results;
+        // if matchall is there, we need foods with all keywords, else food which atleast one keyword
+        for (FoodHandle food : queryFoods(keywords, matchall))
+        {
+            results.push_back(food.share());
+        }
+        return results;
+    }
+
+    // Foods whose calories lie in [minCalories, maxCalories], in ascending calorie order
+    vector<shared_ptr<Food>> searchFoodsByCalorieRange(float minCalories, float maxCalories) const
+    {
+        return searchFoods({}, false, minCalories, maxCalories);
+    }
+
+    vector<shared_ptr<Food>> searchFoods(const vector<string> &keywords, bool matchall,
+                                         float minCalories, float maxCalories) const
+    {
+        ScopedTimer timer(Instrumentation::SEARCH);
+        vector<shared_ptr<Food>> results;
+        for (FoodHandle food : queryFoods(keywords, matchall, minCalories, maxCalories))
+        {
+            results.push_back(food.share());
+        }
+        return results;
+    }
+
+    shared_ptr<Food> getFood(const string &name) const
+    {
+        auto it = foods.find(name);
+        if (it != foods.end())
+        {
+            return it->second;
+        }
+        return nullptr;
+    }
+
+    // Looks up many names at once. The names are visited in sorted order so each
+    // distinct name costs one catalog lookup. Unknown names resolve to nullptr.
+    vector<shared_ptr<Food>> resolveFoods(const vector<string> &names) const
+    {
+        vector<uint32_t> order(names.size());
+        for (uint32_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+             { return names[a] < names[b]; });
+
+        vector<shared_ptr<Food>> resolved(names.size());
+        for (size_t k = 0; k < order.size(); k++)
+        {
+            uint32_t i = order[k];
+            if (k > 0 && names[order[k - 1]] == names[i])
+            {
+                resolved[i] = resolved[order[k - 1]];
+                continue;
+            }
+            auto it = foods.find(names[i]);
+            if (it != foods.end())
+                resolved[i] = it->second;
+        }
+        return resolved;
+    }
+
+    void listAllFoods(OutputFormat format = OutputFormat::TABLE) const
+    {
+        ListingRenderer out(format, {"name", "type", "calories"});
+        if (out.isTable())
+        {
+            out << "\n=== All Foods in Database (" << foods.size() << ") ===\n";
+        }
+        for (const auto &[name, food] : foods)
+        {
+            if (out.isTable())
+                out << name << " (" << food->getType() << ") - " << food->getCalories() << " calories\n";
+            else
+                out.row(name, food->getType(), food->getCalories());
+        }
+        if (out.isTable())
+        {
+            out << "===========================\n";
+        }
+    }
+
+    // Search results, one food per line; table output says when nothing matched. The
+    // lazy query runs as the results are listed, so the listing is timed as a search.
+    template <typename Results>
+    static void listFoods(const Results &results, OutputFormat format = OutputFormat::TABLE)
+    {
+        ScopedTimer timer(Instrumentation::SEARCH);
+        ListingRenderer out(format, {"name", "type", "calories"});
+        bool any = false;
+        for (FoodHandle food : results)
+        {
+            if (out.isTable())
+                out << food->getName() << " (" << food->getType() << ") - " << food->getCalories() << " calories\n";
+            else
+                out.row(food->getName(), food->getType(), food->getCalories());
+            any = true;
+        }
+        if (!any && out.isTable())
+        {
+            out << "No foods match the given criteria.\n";
+        }
+    }
+
+    bool isModified() const
+    {
+        return dirty.isDirty();
+    }
+
+    DirtyTracker &dirtyTracker() { return dirty; }
+};
+
+// Food log entry for a specific day
+class FoodEntry
+{
+public:
+    string foodName;
+    double servings;
+    double calories;
+
+    FoodEntry(const string &name, double servs, double cals)
+        : foodName(name), servings(servs), calories(cals) {}
+};
+
+// Calendar date stored as a 32-bit day number (days since 1970-01-01, proleptic
+// Gregorian). Comparison and day arithmetic are plain integer operations; only
+// parsing and formatting touch the calendar.
+class Date
+{
+private:
+    int32_t days;
+
+public:
+    constexpr Date() : days(0) {}
+    constexpr explicit Date(int32_t dayNumber) : days(dayNumber) {}
+
+    // Years parse accepts. Per-day structures such as CalorieRangeTree span the
+    // stored dates, so a stray year like 0001 would otherwise cost them hundreds
+    // of megabytes.
+    static constexpr int MIN_YEAR = 1900;
+    static constexpr int MAX_YEAR = 2199;
+
+    struct Civil
+    {
+        int year;
+        int month;
+        int day;
+    };
+
+    static constexpr bool isLeapYear(int year)
+    {
+        return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    }
+
+    static constexpr int daysInMonth(int year, int month)
+    {
+        // 30 or 31 from the month's parity (flipping after July), February patched up
+        return month == 2 ? 28 + isLeapYear(year) : 30 + ((month + (month > 7)) & 1);
+    }
+
+    static constexpr Date fromCivil(int year, int month, int day)
+    {
+        year -= month <= 2;
+        int era = (year >= 0 ? year : year - 399) / 400;
+        int yearOfEra = year - era * 400;
+        int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+        int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+        return Date(era * 146097 + dayOfEra - 719468);
+    }
+
+    constexpr Civil toCivil() const
+    {
+        int z = days + 719468;
+        int era = (z >= 0 ? z : z - 146096) / 146097;
+        int dayOfEra = z - era * 146097;
+        int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+        int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+        int mp = (5 * dayOfYear + 2) / 153;
+        int day = dayOfYear - (153 * mp + 2) / 5 + 1;
+        int month = mp < 10 ? mp + 3 : mp - 9;
+        return Civil{yearOfEra + era * 400 + (month <= 2), month, day};
+    }
+
+    // Parses YYYY-MM-DD with the year in [MIN_YEAR, MAX_YEAR]. Digit and separator
+    // checks are folded into one mask so a well-formed date takes no data-dependent
+    // branches until the range check.
+    static bool parse(const string &text, Date &out)
+    {
+        if (text.size() != 10)
+            return false;
+
+        const char *c = text.data();
+        unsigned bad = (c[4] ^ '-') | (c[7] ^ '-');
+        int digits[8];
+        static constexpr int positions[8] = {0, 1, 2, 3, 5, 6, 8, 9};
+        for (int i = 0; i < 8; i++)
+        {
+            unsigned digit = static_cast<unsigned char>(c[positions[i]]) - '0';
+            bad |= (digit > 9);
+            digits[i] = static_cast<int>(digit);
+        }
+        if (bad)
+            return false;
+
+        int year = digits[0] * 1000 + digits[1] * 100 + digits[2] * 10 + digits[3];
+        int month = digits[4] * 10 + digits[5];
+        int day = digits[6] * 10 + digits[7];
+        if (year < MIN_YEAR || year > MAX_YEAR || month < 1 || month > 12 || day < 1 || day > daysInMonth(year, month))
+            return false;
+
+        out = fromCivil(year, month, day);
+        return true;
+    }
+
+    static Date today()
+    {
+        time_t now = chrono::system_clock::to_time_t(chrono::system_clock::now());
+        tm local;
+        localtime_r(&now, &local); // localtime's shared buffer is not safe across user threads
+        return fromCivil(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday);
+    }
+
+    // Writes exactly 10 characters (no terminator)
+    void format(char *out) const
+    {
+        Civil c = toCivil();
+        out[0] = static_cast<char>('0' + c.year / 1000 % 10);
+        out[1] = static_cast<char>('0' + c.year / 100 % 10);
+        out[2] = static_cast<char>('0' + c.year / 10 % 10);
+        out[3] = static_cast<char>('0' + c.year % 10);
+        out[4] = '-';
+        out[5] = static_cast<char>('0' + c.month / 10);
+        out[6] = static_cast<char>('0' + c.month % 10);
+        out[7] = '-';
+        out[8] = static_cast<char>('0' + c.day / 10);
+        out[9] = static_cast<char>('0' + c.day % 10);
+    }
+
+    string toString() const
+    {
+        string text(10, '\0');
+        format(&text[0]);
+        return text;
+    }
+
+    constexpr int32_t dayNumber() const { return days; }
+
+    Date firstOfMonth() const
+    {
+        Civil c = toCivil();
+        return Date(days - (c.day - 1));
+    }
+
+    Date lastOfMonth() const
+    {
+        Civil c = toCivil();
+        return Date(days + (daysInMonth(c.year, c.month) - c.day));
+    }
+
+    Date firstOfYear() const { return fromCivil(toCivil().year, 1, 1); }
+    Date lastOfYear() const { return fromCivil(toCivil().year, 12, 31); }
+
+    // Same day n months later, clamped to the end of shorter months
+    Date addMonths(int n) const
+    {
+        Civil c = toCivil();
+        int monthIndex = c.year * 12 + (c.month - 1) + n;
+        int year = (monthIndex >= 0 ? monthIndex : monthIndex - 11) / 12;
+        int month = monthIndex - year * 12 + 1;
+        return fromCivil(year, month, min(c.day, daysInMonth(year, month)));
+    }
+
+    constexpr Date operator+(int n) const { return Date(days + n); }
+    constexpr Date operator-(int n) const { return Date(days - n); }
+    constexpr int operator-(Date other) const { return days - other.days; }
+
+    constexpr bool operator==(Date other) const { return days == other.days; }
+    constexpr bool operator!=(Date other) const { return days != other.days; }
+    constexpr bool operator<(Date other) const { return days < other.days; }
+    constexpr bool operator<=(Date other) const { return days <= other.days; }
+    constexpr bool operator>(Date other) const { return days > other.days; }
+    constexpr bool operator>=(Date other) const { return days >= other.days; }
+
+    friend ostream &operator<<(ostream &os, Date date)
+    {
+        char text[10];
+        date.format(text);
+        // Inserted as a string so setw and left/right pad it like any other field
+        return os << string_view(text, 10);
+    }
+};
+
+namespace std
+{
+    template <>
+    struct hash<Date>
+    {
+        size_t operator()(Date date) const noexcept { return hash<int32_t>()(date.dayNumber()); }
+    };
+}
+
+// Date handling utility
+class DateUtil
+{
+public:
+    static Date getCurrentDate()
+    {
+        return Date::today();
+    }
+
+    static bool isValidDate(const string &dateStr)
+    {
+        Date date;
+        return Date::parse(dateStr, date);
+    }
+};
+
+// Aggregate of daily calorie totals over a span of days
+struct CalorieRangeSummary
+{
+    double total = 0.0;
+    double max = 0.0;
+    Date maxDay;        // day holding the maximum (valid when loggedDays > 0)
+    int loggedDays = 0; // days in the span with at least one entry
+
+    double averagePerLoggedDay() const { return loggedDays ? total / loggedDays : 0.0; }
+
+    static CalorieRangeSummary combine(const CalorieRangeSummary &a, const CalorieRangeSummary &b)
+    {
+        CalorieRangeSummary r;
+        r.total = a.total + b.total;
+        r.loggedDays = a.loggedDays + b.loggedDays;
+        if (b.loggedDays && (!a.loggedDays || b.max > a.max))
+        {
+            r.max = b.max;
+            r.maxDay = b.maxDay;
+        }
+        else
+        {
+            r.max = a.max;
+            r.maxDay = a.maxDay;
+        }
+        return r;
+    }
+};
+
+// Segment tree over dates holding each day's calorie total. Point updates
+// and range queries (total, max, logged days) are O(log n) in the covered span;
+// the span doubles whenever a day outside it is set.
+class CalorieRangeTree
+{
+private:
+    int firstDay = 0;
+    size_t capacity = 0; // leaves, always a power of two
+    vector<CalorieRangeSummary> nodes;
+
+    void grow(int day)
+    {
+        int newFirst = capacity ? min(firstDay, day) : day;
+        int lastDay = capacity ? max(firstDay + static_cast<int>(capacity) - 1, day) : day;
+        size_t newCapacity = max<size_t>(capacity, 64);
+        while (newFirst + static_cast<long long>(newCapacity) - 1 < lastDay)
+            newCapacity *= 2;
+        // Leave headroom before the first day when growing backwards
+        if (capacity && day < firstDay)
+        {
+            newCapacity *= 2;
+            newFirst = lastDay - static_cast<int>(newCapacity) + 1;
+        }
+
+        vector<CalorieRangeSummary> newNodes(2 * newCapacity);
+        for (size_t i = 0; i < capacity; i++)
+        {
+            newNodes[newCapacity + (firstDay - newFirst) + i] = nodes[capacity + i];
+        }
+        for (size_t i = newCapacity - 1; i > 0; i--)
+        {
+            newNodes[i] = CalorieRangeSummary::combine(newNodes[2 * i], newNodes[2 * i + 1]);
+        }
+
+        firstDay = newFirst;
+        capacity = newCapacity;
+        nodes.swap(newNodes);
+    }
+
+public:
+    void clear()
+    {
+        firstDay = 0;
+        capacity = 0;
+        nodes.clear();
+    }
+
+    // Sets the total for one day; a day with no entries should be set with logged = false
+    void set(Date date, double total, bool logged = true)
+    {
+        int day = date.dayNumber();
+        if (!capacity || day < firstDay || day >= firstDay + static_cast<int>(capacity))
+        {
+            if (!logged)
+                return;
+            grow(day);
+        }
+
+        size_t i = capacity + (day - firstDay);
+        nodes[i].total = logged ? total : 0.0;
+        nodes[i].max = nodes[i].total;
+        nodes[i].maxDay = date;
+        nodes[i].loggedDays = logged ? 1 : 0;
+        for (i /= 2; i > 0; i /= 2)
+        {
+            nodes[i] = CalorieRangeSummary::combine(nodes[2 * i], nodes[2 * i + 1]);
+        }
+    }
+
+    // Aggregate over the inclusive span [from, to]
+    CalorieRangeSummary query(Date from, Date to) const
+    {
+        int fromDay = from.dayNumber();
+        int toDay = to.dayNumber();
+        CalorieRangeSummary left, right;
+        if (!capacity)
+            return left;
+
+        long long lo = max<long long>(fromDay, firstDay) - firstDay;
+        long long hi = min<long long>(toDay, firstDay + static_cast<long long>(capacity) - 1) - firstDay;
+        if (lo > hi)
+            return left;
+
+        // Bottom-up walk; left and right parts are combined in order so ties keep the earliest day
+        size_t l = capacity + lo, r = capacity + hi + 1;
+        while (l < r)
+        {
+            if (l & 1)
+                left = CalorieRangeSummary::combine(left, nodes[l++]);
+            if (r & 1)
+                right = CalorieRangeSummary::combine(nodes[--r], right);
+            l /= 2;
+            r /= 2;
+        }
+        return CalorieRangeSummary::combine(left, right);
+    }
+};
+
+// Stable handle to a diary entry. The index names a slot in the store's slot map
+// and the generation detects a slot that has since been freed and reused.
+struct EntryId
+{
+    uint32_t index = numeric_limits<uint32_t>::max();
+    uint32_t generation = 0;
+
+    bool valid() const { return index != numeric_limits<uint32_t>::max(); }
+    bool operator==(const EntryId &other) const { return index == other.index && generation == other.generation; }
+};
+
+// Diary entries stored column-wise: one dense array per field, grouped by day in
+// date order. The day table maps each logged date to its slice of the columns and
+// carries that day's running calorie total.
+//
+// Every entry has an EntryId resolved through a slot map, so looking an entry up
+// by id is O(1) and the id survives inserts and purges elsewhere. Removal only
+// marks the entry dead (a tombstone) and restoring revives it in place; neither
+// moves a column, but both find the entry's day by binary search, O(log D) for D
+// logged days. Inserting costs O(log D) plus the entries after the insertion
+// point: their columns shift, their day offsets move and their slots are
+// re-pointed. Appending to the latest day is therefore O(log D) amortized, while
+// inserting into an earlier day is O(n). Tombstones are purged per day once they
+// pile up, which likewise shifts and re-points the later entries.
+class DiaryColumnStore
+{
+public:
+    // Half-open range of column positions; may include dead entries
+    struct Slice
+    {
+        size_t begin = 0;
+        size_t end = 0;
+
+        size_t size() const { return end - begin; }
+        bool empty() const { return begin == end; }
+    };
+
+    static constexpr size_t npos = numeric_limits<size_t>::max();
+
+private:
+    // Entry columns
+    vector<Date> dates;
+    vector<uint32_t> foodIds;
+    vector<double> servings;
+    vector<double> calories;
+    vector<uint8_t> live;     // 0 for removed entries awaiting purge
+    vector<uint32_t> slotIds; // slot map index of the entry at each position
+
+    // Day table, sorted by date; dayOffsets holds one extra trailing end offset
+    vector<Date> days;
+    vector<size_t> dayOffsets{0};
+    vector<double> dayTotals;    // over live entries only
+    vector<uint32_t> dayLive;    // live entries per day
+
+    // Slot map: entry id -> column position
+    struct Slot
+    {
+        uint32_t position;
+        uint32_t generation;
+    };
+    vector<Slot> slots;
+    vector<uint32_t> freeSlots;
+
+    // Food name dictionary referenced by foodIds
+    vector<string> foodNames;
+    unordered_map<string, uint32_t> foodIdByName;
+
+    // Food id -> ids of the entries logging it. Ids of purged entries linger until
+    // the list is next walked.
+    vector<vector<EntryId>> entriesByFood;
+
+    // Index of the day in the day table, or days.size() when it has no row
+    size_t findDay(Date date) const
+    {
+        auto it = lower_bound(days.begin(), days.end(), date);
+        return it != days.end() && *it == date ? it - days.begin() : days.size();
+    }
+
+    size_t ensureDay(Date date)
+    {
+        auto it = lower_bound(days.begin(), days.end(), date);
+        size_t d = it - days.begin();
+        if (it == days.end() || *it != date)
+        {
+            days.insert(it, date);
+            dayTotals.insert(dayTotals.begin() + d, 0.0);
+            dayLive.insert(dayLive.begin() + d, 0);
+            dayOffsets.insert(dayOffsets.begin() + d, dayOffsets[d]);
+        }
+        return d;
+    }
+
+    void dropDay(size_t d)
+    {
+        days.erase(days.begin() + d);
+        dayTotals.erase(dayTotals.begin() + d);
+        dayLive.erase(dayLive.begin() + d);
+        dayOffsets.erase(dayOffsets.begin() + d);
+    }
+
+    void shiftOffsetsAfter(size_t d, ptrdiff_t delta)
+    {
+        for (size_t k = d + 1; k < dayOffsets.size(); k++)
+        {
+            dayOffsets[k] += delta;
+        }
+    }
+
+    // Points the slot map at the current positions of the entries from pos onwards
+    void reindexFrom(size_t pos)
+    {
+        for (; pos < slotIds.size(); pos++)
+        {
+            slots[slotIds[pos]].position = static_cast<uint32_t>(pos);
+        }
+    }
+
+    uint32_t allocateSlot()
+    {
+        if (!freeSlots.empty())
+        {
+            uint32_t index = freeSlots.back();
+            freeSlots.pop_back();
+            return index;
+        }
+        slots.push_back(Slot{0, 0});
+        return static_cast<uint32_t>(slots.size() - 1);
+    }
+
+    void freeSlot(uint32_t index)
+    {
+        slots[index].generation++;
+        freeSlots.push_back(index);
+    }
+
+    // Physically removes the positions in [first, last) of day d whose keep flag is false
+    template <typename Keep>
+    void removeFromDay(size_t d, size_t first, size_t last, Keep keep)
+    {
+        size_t out = first;
+        for (size_t pos = first; pos < last; pos++)
+        {
+            if (keep(pos))
+            {
+                dates[out] = dates[pos];
+                foodIds[out] = foodIds[pos];
+                servings[out] = servings[pos];
+                calories[out] = calories[pos];
+                live[out] = live[pos];
+                slotIds[out] = slotIds[pos];
+                out++;
+            }
+            else
+            {
+                freeSlot(slotIds[pos]);
+            }
+        }
+
+        size_t removed = last - out;
+        if (removed == 0)
+            return;
+
+        dates.erase(dates.begin() + out, dates.begin() + last);
+        foodIds.erase(foodIds.begin() + out, foodIds.begin() + last);
+        servings.erase(servings.begin() + out, servings.begin() + last);
+        calories.erase(calories.begin() + out, calories.begin() + last);
+        live.erase(live.begin() + out, live.begin() + last);
+        slotIds.erase(slotIds.begin() + out, slotIds.begin() + last);
+
+        shiftOffsetsAfter(d, -static_cast<ptrdiff_t>(removed));
+        reindexFrom(first);
+        if (dayOffsets[d] == dayOffsets[d + 1])
+        {
+            dropDay(d);
+        }
+    }
+
+public:
+    void reserve(size_t entryCount)
+    {
+        dates.reserve(entryCount);
+        foodIds.reserve(entryCount);
+        servings.reserve(entryCount);
+        calories.reserve(entryCount);
+        live.reserve(entryCount);
+        slotIds.reserve(entryCount);
+        slots.reserve(entryCount);
+    }
+
+    uint32_t internFood(const string &name)
+    {
+        auto it = foodIdByName.find(name);
+        if (it != foodIdByName.end())
+        {
+            return it->second;
+        }
+        uint32_t id = static_cast<uint32_t>(foodNames.size());
+        foodNames.push_back(name);
+        foodIdByName.emplace(name, id);
+        entriesByFood.emplace_back();
+        return id;
+    }
+
+    // Id of a food already in the dictionary
+    bool findFood(const string &name, uint32_t &foodId) const
+    {
+        auto it = foodIdByName.find(name);
+        if (it == foodIdByName.end())
+            return false;
+        foodId = it->second;
+        return true;
+    }
+
+    // Calls fn(position) for every entry, live or removed, that logs the food
+    template <typename Fn>
+    void forEachEntryOf(uint32_t foodId, Fn fn)
+    {
+        vector<EntryId> &ids = entriesByFood[foodId];
+        size_t kept = 0;
+        for (EntryId id : ids)
+        {
+            size_t pos = positionOf(id);
+            if (pos == npos)
+                continue;
+            ids[kept++] = id;
+            fn(pos);
+        }
+        ids.resize(kept);
+    }
+
+    // Replaces an entry's calories, keeping its day total in step
+    void setCalories(size_t pos, double cals)
+    {
+        if (live[pos])
+        {
+            size_t d = findDay(dates[pos]);
+            dayTotals[d] += cals - calories[pos];
+        }
+        calories[pos] = cals;
+    }
+
+    const string &foodName(uint32_t foodId) const { return foodNames[foodId]; }
+    size_t foodCount() const { return foodNames.size(); }
+
+    // Inserts a live entry at the given position within its day (clamped to the day's end)
+    EntryId insert(Date date, size_t indexInDay, uint32_t foodId, double servs, double cals)
+    {
+        size_t d = ensureDay(date);
+        size_t pos = dayOffsets[d] + min(indexInDay, dayOffsets[d + 1] - dayOffsets[d]);
+        uint32_t slot = allocateSlot();
+
+        dates.insert(dates.begin() + pos, date);
+        foodIds.insert(foodIds.begin() + pos, foodId);
+        servings.insert(servings.begin() + pos, servs);
+        calories.insert(calories.begin() + pos, cals);
+        live.insert(live.begin() + pos, 1);
+        slotIds.insert(slotIds.begin() + pos, slot);
+
+        shiftOffsetsAfter(d, 1);
+        reindexFrom(pos);
+        dayTotals[d] += cals;
+        dayLive[d]++;
+        EntryId id{slot, slots[slot].generation};
+        entriesByFood[foodId].push_back(id);
+        return id;
+    }
+
+    EntryId append(Date date, uint32_t foodId, double servs, double cals)
+    {
+        return insert(date, npos, foodId, servs, cals);
+    }
+
+    struct NewEntry
+    {
+        Date date;
+        uint32_t foodId;
+        double servings;
+        double calories;
+    };
+
+    // Adds many entries, each at the end of its day, and returns their ids in input
+    // order. Rows that all fall on or after the latest day are appended; otherwise
+    // the rows are merged into the columns in one pass rather than shifting the
+    // columns once per row.
+    vector<EntryId> insertBatch(const vector<NewEntry> &rows)
+    {
+        vector<uint32_t> order(rows.size());
+        iota(order.begin(), order.end(), 0);
+        stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+                    { return rows[a].date < rows[b].date; });
+
+        vector<EntryId> ids(rows.size());
+        if (rows.empty())
+            return ids;
+        if (days.empty() || rows[order.front()].date >= days.back())
+        {
+            for (uint32_t i : order)
+                ids[i] = insert(rows[i].date, npos, rows[i].foodId, rows[i].servings, rows[i].calories);
+            return ids;
+        }
+
+        size_t total = size() + rows.size();
+        vector<Date> mergedDates;
+        vector<uint32_t> mergedFoodIds;
+        vector<double> mergedServings;
+        vector<double> mergedCalories;
+        vector<uint8_t> mergedLive;
+        vector<uint32_t> mergedSlotIds;
+        mergedDates.reserve(total);
+        mergedFoodIds.reserve(total);
+        mergedServings.reserve(total);
+        mergedCalories.reserve(total);
+        mergedLive.reserve(total);
+        mergedSlotIds.reserve(total);
+
+        vector<Date> mergedDays;
+        vector<size_t> mergedOffsets{0};
+        vector<double> mergedTotals;
+        vector<uint32_t> mergedDayLive;
+
+        size_t d = 0, r = 0;
+        while (d < days.size() || r < order.size())
+        {
+            Date next = d < days.size() ? days[d] : rows[order[r]].date;
+            if (r < order.size() && rows[order[r]].date < next)
+                next = rows[order[r]].date;
+
+            double dayTotal = 0.0;
+            uint32_t dayLiveCount = 0;
+            if (d < days.size() && days[d] == next)
+            {
+                for (size_t pos = dayOffsets[d]; pos < dayOffsets[d + 1]; pos++)
+                {
+                    mergedDates.push_back(dates[pos]);
+                    mergedFoodIds.push_back(foodIds[pos]);
+                    mergedServings.push_back(servings[pos]);
+                    mergedCalories.push_back(calories[pos]);
+                    mergedLive.push_back(live[pos]);
+                    mergedSlotIds.push_back(slotIds[pos]);
+                }
+                dayTotal = dayTotals[d];
+                dayLiveCount = dayLive[d];
+                d++;
+            }
+            for (; r < order.size() && rows[order[r]].date == next; r++)
+            {
+                const NewEntry &row = rows[order[r]];
+                uint32_t slot = allocateSlot();
+                ids[order[r]] = EntryId{slot, slots[slot].generation};
+                entriesByFood[row.foodId].push_back(ids[order[r]]);
+                mergedDates.push_back(row.date);
+                mergedFoodIds.push_back(row.foodId);
+                mergedServings.push_back(row.servings);
+                mergedCalories.push_back(row.calories);
+                mergedLive.push_back(1);
+                mergedSlotIds.push_back(slot);
+                dayTotal += row.calories;
+                dayLiveCount++;
+            }
+
+            mergedDays.push_back(next);
+            mergedOffsets.push_back(mergedDates.size());
+            mergedTotals.push_back(dayTotal);
+            mergedDayLive.push_back(dayLiveCount);
+        }
+
+        dates.swap(mergedDates);
+        foodIds.swap(mergedFoodIds);
+        servings.swap(mergedServings);
+        calories.swap(mergedCalories);
+        live.swap(mergedLive);
+        slotIds.swap(mergedSlotIds);
+        days.swap(mergedDays);
+        dayOffsets.swap(mergedOffsets);
+        dayTotals.swap(mergedTotals);
+        dayLive.swap(mergedDayLive);
+        reindexFrom(0);
+        return ids;
+    }
+
+    // Column position of an entry, or npos once its slot has been freed
+    size_t positionOf(EntryId id) const
+    {
+        if (!id.valid() || id.index >= slots.size() || slots[id.index].generation != id.generation)
+        {
+            return npos;
+        }
+        return slots[id.index].position;
+    }
+
+    EntryId idAt(size_t pos) const
+    {
+        return EntryId{slotIds[pos], slots[slotIds[pos]].generation};
+    }
+
+    // Marks an entry dead in O(log D) for the day lookup; it keeps its position so
+    // restore can revive it
+    bool remove(EntryId id)
+    {
+        size_t pos = positionOf(id);
+        if (pos == npos || !live[pos])
+        {
+            return false;
+        }
+        size_t d = findDay(dates[pos]);
+        live[pos] = 0;
+        dayLive[d]--;
+        dayTotals[d] = dayLive[d] ? dayTotals[d] - calories[pos] : 0.0; // no rounding residue
+        return true;
+    }
+
+    bool restore(EntryId id)
+    {
+        size_t pos = positionOf(id);
+        if (pos == npos || live[pos])
+        {
+            return false;
+        }
+        size_t d = findDay(dates[pos]);
+        live[pos] = 1;
+        dayLive[d]++;
+        dayTotals[d] += calories[pos];
+        return true;
+    }
+
+    // Dead entries in a day that have not been purged yet
+    size_t tombstones(Date date) const
+    {
+        size_t d = findDay(date);
+        return d == days.size() ? 0 : (dayOffsets[d + 1] - dayOffsets[d]) - dayLive[d];
+    }
+
+    // Purges a day's dead entries, except those the caller still refers to
+    template <typename Pinned>
+    void purgeDay(Date date, Pinned pinned)
+    {
+        size_t d = findDay(date);
+        if (d == days.size())
+            return;
+        removeFromDay(d, dayOffsets[d], dayOffsets[d + 1], [&](size_t pos)
+                      { return live[pos] || pinned(idAt(pos)); });
+    }
+
+    // Removes every entry of a day at once, freeing their ids
+    void eraseDay(Date date)
+    {
+        size_t d = findDay(date);
+        if (d == days.size())
+            return;
+        removeFromDay(d, dayOffsets[d], dayOffsets[d + 1], [](size_t)
+                      { return false; });
+    }
+
+    Slice day(Date date) const
+    {
+        size_t d = findDay(date);
+        if (d == days.size())
+        {
+            return Slice();
+        }
+        return Slice{dayOffsets[d], dayOffsets[d + 1]};
+    }
+
+    // Column positions of every entry dated within [from, to]
+    Slice range(Date from, Date to) const
+    {
+        size_t first = lower_bound(days.begin(), days.end(), from) - days.begin();
+        size_t last = upper_bound(days.begin(), days.end(), to) - days.begin();
+        if (first >= last)
+        {
+            return Slice{dayOffsets[first], dayOffsets[first]};
+        }
+        return Slice{dayOffsets[first], dayOffsets[last]};
+    }
+
+    size_t liveCount(Date date) const
+    {
+        size_t d = findDay(date);
+        return d == days.size() ? 0 : dayLive[d];
+    }
+
+    bool hasDay(Date date) const { return liveCount(date) > 0; }
+
+    double dayTotal(Date date) const
+    {
+        size_t d = findDay(date);
+        return d == days.size() ? 0.0 : dayTotals[d];
+    }
+
+    // Position of the n-th live entry of a day, or npos
+    size_t livePosition(Date date, size_t n) const
+    {
+        Slice slice = day(date);
+        for (size_t pos = slice.begin; pos < slice.end; pos++)
+        {
+            if (live[pos] && n-- == 0)
+                return pos;
+        }
+        return npos;
+    }
+
+    // Day table access, in date order; rows with no live entries may appear
+    size_t dayCount() const { return days.size(); }
+    Date dayAt(size_t d) const { return days[d]; }
+    Slice sliceAt(size_t d) const { return Slice{dayOffsets[d], dayOffsets[d + 1]}; }
+    double totalAt(size_t d) const { return dayTotals[d]; }
+    size_t liveCountAt(size_t d) const { return dayLive[d]; }
+
+    // Column access by position
+    size_t size() const { return calories.size(); }
+    bool isLive(size_t pos) const { return live[pos] != 0; }
+    Date dateAt(size_t pos) const { return dates[pos]; }
+    uint32_t foodIdAt(size_t pos) const { return foodIds[pos]; }
+    const string &foodNameAt(size_t pos) const { return foodNames[foodIds[pos]]; }
+    double servingsAt(size_t pos) const { return servings[pos]; }
+    double caloriesAt(size_t pos) const { return calories[pos]; }
+
+    FoodEntry entryAt(size_t pos) const
+    {
+        return FoodEntry(foodNameAt(pos), servings[pos], calories[pos]);
+    }
+
+    // Calories per food id over [from, to], a straight scan of three dense columns
+    vector<double> caloriesByFood(Date from, Date to) const
+    {
+        vector<double> totals(foodNames.size(), 0.0);
+        Slice slice = range(from, to);
+        const uint32_t *ids = foodIds.data();
+        const double *cals = calories.data();
+        const uint8_t *alive = live.data();
+        for (size_t pos = slice.begin; pos < slice.end; pos++)
+        {
+            totals[ids[pos]] += cals[pos] * alive[pos];
+        }
+        return totals;
+    }
+};
+
+// Append-only log of diary changes, one JSON line per change. Every record holds
+// the full contents of the day it touched, so replaying a record twice is harmless
+// and a torn final line costs only that last change. Each append is synced to disk.
+class DiaryJournal
+{
+private:
+    string path;
+    int fd;
+
+    bool reopen(int extraFlags)
+    {
+        close();
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | extraFlags, 0644);
+        if (fd < 0)
+            return false;
+
+        // A crash mid-append leaves a torn last record; end its line so the next
+        // record is not glued onto it and lost with it on replay
+        off_t size = ::lseek(fd, 0, SEEK_END);
+        char last = '\n';
+        if (size > 0 && ::pread(fd, &last, 1, size - 1) == 1 && last != '\n')
+            return ::write(fd, "\n", 1) == 1;
+        return true;
+    }
+
+public:
+    explicit DiaryJournal(const string &p) : path(p), fd(-1) {}
+
+    ~DiaryJournal()
+    {
+        close();
+    }
+
+    DiaryJournal(const DiaryJournal &) = delete;
+    DiaryJournal &operator=(const DiaryJournal &) = delete;
+
+    const string &getPath() const { return path; }
+
+    // Journal moved aside while its records are folded into the base file
+    string getRotatedPath() const { return path + ".compacting"; }
+
+    bool open()
+    {
+        return reopen(0);
+    }
+
+    void close()
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    bool append(const string &record)
+    {
+        if (fd < 0)
+            return false;
+
+        string line = record + "\n";
+        const char *data = line.data();
+        size_t remaining = line.size();
+        while (remaining > 0)
+        {
+            ssize_t written = ::write(fd, data, remaining);
+            if (written < 0)
+                return false;
+            data += written;
+            remaining -= static_cast<size_t>(written);
+        }
+        Instrumentation::count(Instrumentation::BYTES_WRITTEN, line.size());
+        return ::fdatasync(fd) == 0;
+    }
+
+    // Moves the current records aside and starts an empty journal. If an earlier
+    // compaction never finished, the records are appended to its leftovers instead.
+    bool rotate()
+    {
+        close();
+        string rotated = getRotatedPath();
+        ifstream leftover(rotated, ios::binary | ios::ate);
+        if (leftover.is_open())
+        {
+            bool torn = false;
+            if (leftover.tellg() > 0)
+            {
+                leftover.seekg(-1, ios::end);
+                torn = leftover.get() != '\n';
+            }
+            leftover.close();
+            ifstream current(path, ios::binary);
+            ofstream combined(rotated, ios::binary | ios::app);
+            if (torn)
+                combined << '\n';
+            // Streaming an empty buffer would set failbit, so only copy records
+            if (current.peek() != ifstream::traits_type::eof())
+                combined << current.rdbuf();
+            combined.close();
+            if (!combined)
+            {
+                open();
+                return false;
+            }
+            return reopen(O_TRUNC);
+        }
+
+        if (rename(path.c_str(), rotated.c_str()) != 0)
+        {
+            open();
+            return false;
+        }
+        return open();
+    }
+
+    // Feeds every complete record of a journal file to apply; returns how many were applied
+    static size_t replay(const string &journalPath, const function<void(const json &)> &apply)
+    {
+        ifstream file(journalPath);
+        if (!file.is_open())
+            return 0;
+
+        size_t applied = 0;
+        uint64_t bytes = 0;
+        string line;
+        while (getline(file, line))
+        {
+            bytes += line.size() + 1;
+            if (line.empty())
+                continue;
+            try
+            {
+                apply(json::parse(line));
+                applied++;
+            }
+            catch (const exception &e)
+            {
+                cerr << "Skipping unreadable journal record in " << journalPath << ": " << e.what() << endl;
+            }
+        }
+        Instrumentation::count(Instrumentation::BYTES_READ, bytes);
+        return applied;
+    }
+};
+
+// Undoable diary change, stored by value. The entry is referenced by its stable id
+// and the food through the diary's food dictionary, so a record is a few dozen
+// bytes with no heap data.
+struct DiaryCommand
+{
+    enum class Kind : uint8_t
+    {
+        ADD,
+        DELETE,
+        IMPORT
+    };
+
+    Kind kind;
+    Date date;
+    EntryId entry; // the entry added or deleted
+    uint32_t foodId;
+    double servings;
+    double calories;
+    // An IMPORT covers a whole batch: foodId names the batch in the diary's import
+    // table, servings holds the number of entries and calories their total.
+
+    string getDescription(const DiaryColumnStore &store) const
+    {
+        stringstream ss;
+        if (kind == Kind::ADD)
+        {
+            ss << "Add " << servings << " serving(s) of " << store.foodName(foodId) << " ("
+               << calories << " calories) on " << date;
+        }
+        else if (kind == Kind::DELETE)
+        {
+            ss << "Delete " << servings << " serving(s) of "
+               << store.foodName(foodId) << " from " << date;
+        }
+        else
+        {
+            ss << "Import " << static_cast<size_t>(servings) << " entries (" << calories
+               << " calories) from " << date;
+        }
+        return ss.str();
+    }
+};
+
+// Undo/redo history in a fixed-size ring buffer. Recording a change discards the
+// redo entries; once the buffer is full the oldest undo entry is overwritten.
+// Every discarded entry is passed to the optional dropped callback.
+class CommandHistory
+{
+public:
+    using DropHandler = function<void(const DiaryCommand &)>;
+
+private:
+    vector<DiaryCommand> ring;
+    size_t start;     // slot of the oldest undo entry
+    size_t undoCount; // undo entries, followed in the ring by redoCount redo entries
+    size_t redoCount;
+
+    size_t slot(size_t i) const { return (start + i) % ring.size(); }
+
+public:
+    explicit CommandHistory(size_t maxEntries)
+        : ring(maxEntries), start(0), undoCount(0), redoCount(0) {}
+
+    // Resizes the buffer, keeping the newest undo entries and then the nearest redo ones
+    void setCapacity(size_t maxEntries, const DropHandler &dropped = nullptr)
+    {
+        vector<DiaryCommand> resized;
+        resized.reserve(maxEntries);
+        size_t keepUndo = min(undoCount, maxEntries);
+        for (size_t i = 0; dropped && i < undoCount - keepUndo; i++)
+            dropped(ring[slot(i)]);
+        for (size_t i = undoCount - keepUndo; i < undoCount; i++)
+            resized.push_back(ring[slot(i)]);
+        size_t keepRedo = min(redoCount, maxEntries - keepUndo);
+        for (size_t i = 0; i < keepRedo; i++)
+            resized.push_back(ring[slot(undoCount + i)]);
+        for (size_t i = keepRedo; dropped && i < redoCount; i++)
+            dropped(ring[slot(undoCount + i)]);
+
+        resized.resize(maxEntries);
+        ring.swap(resized);
+        start = 0;
+        undoCount = keepUndo;
+        redoCount = keepRedo;
+    }
+
+    size_t capacity() const { return ring.size(); }
+    size_t memoryUsage() const { return ring.size() * sizeof(DiaryCommand); }
+
+    void push(const DiaryCommand &command, const DropHandler &dropped = nullptr)
+    {
+        for (size_t i = 0; dropped && i < redoCount; i++)
+            dropped(redoAt(i));
+        redoCount = 0;
+        if (ring.empty())
+        {
+            if (dropped)
+                dropped(command);
+            return;
+        }
+
+        if (undoCount == ring.size())
+        {
+            if (dropped)
+                dropped(ring[start]);
+            ring[start] = command;
+            start = (start + 1) % ring.size();
+        }
+        else
+        {
+            ring[slot(undoCount)] = command;
+            undoCount++;
+        }
+    }
+
+    // Steps back; the returned entry stays valid until the next push
+    const DiaryCommand *undo()
+    {
+        if (undoCount == 0)
+            return nullptr;
+        undoCount--;
+        redoCount++;
+        return &ring[slot(undoCount)];
+    }
+
+    const DiaryCommand *redo()
+    {
+        if (redoCount == 0)
+            return nullptr;
+        const DiaryCommand *command = &ring[slot(undoCount)];
+        undoCount++;
+        redoCount--;
+        return command;
+    }
+
+    size_t undoSize() const { return undoCount; }
+    size_t redoSize() const { return redoCount; }
+
+    // i = 0 is the most recent change / the next change to redo
+    const DiaryCommand &undoAt(size_t i) const { return ring[slot(undoCount - 1 - i)]; }
+    const DiaryCommand &redoAt(size_t i) const { return ring[slot(undoCount + i)]; }
+};
+
+// Food diary main class
+class FoodDiary
+{
+private:
+    string logFile;
+    DiaryColumnStore dailyLogs;   // entries of the loaded months and their per-day totals
+    CalorieRangeTree calorieTree; // totals of every logged day, loaded or not, for range reports
+    CommandHistory history{0};
+
+    // Earliest day whose total changed since takeEarliestChange() last ran
+    bool totalsChanged = false;
+    Date totalsChangedFrom;
+    Date currentDate;
+    FoodDatabaseManager &dbManager;
+
+    // Entry ids of each bulk import the history can still undo or redo, by day
+    unordered_map<uint32_t, map<Date, vector<EntryId>>> importBatches;
+    uint32_t nextImportBatch = 0;
+    static const size_t importChunkRows = 65536;
+
+    // The diary lives in one segment file per month plus a manifest listing each
+    // month's per-day totals. Months are read only when one of their dates is
+    // touched; the manifest alone is enough for totals and range reports.
+    string segmentDir;
+    map<Date, json> manifestMonths; // first day of month -> manifest entry
+    set<Date> loadedMonths;
+    set<Date> dirtyMonths; // changed since their segment was last written
+
+    // Changes since the segments were last written go to the journal; once it
+    // holds this many records a background compaction writes the dirty months
+    DiaryJournal journal;
+    size_t journalRecords;
+    static const size_t journalCompactionThreshold = 500;
+    thread compactionThread;
+    atomic<bool> compactionRunning{false};
+    vector<Date> compactingMonths; // months the current compaction writes
+    bool compactionFailed = false; // set by the compaction thread, read once it is joined
+    bool groupCommit = false;
+    set<Date> pendingJournalDays; // changed under group commit, not journaled yet
+    DirtyTracker dirty;
+
+    static const size_t defaultHistoryEntries = 1000;
+    static const size_t defaultHistoryBytes = 64 * 1024;
+
+    // A month's segment contents, captured for the compaction thread
+    struct SegmentSnapshot
+    {
+        string path;
+        json days; // empty when the month no longer has entries
+    };
+
+    // Calorie changes made by re-pricing, per food
+    struct RepriceDelta
+    {
+        size_t entries = 0;
+        double oldCalories = 0.0;
+        double newCalories = 0.0;
+    };
+    using RepriceReport = map<string, RepriceDelta>;
+
+    struct RepricedMonth
+    {
+        Date month;
+        SegmentSnapshot segment;
+        RepriceReport changes;
+    };
+
+    // Re-pricing of the months that are not loaded. Worker threads take whole months
+    // and rewrite their segment files; pollRepricing only swaps the new totals into
+    // the manifest on the diary's own thread once all workers are done.
+    struct RepriceJob
+    {
+        map<string, double> caloriesPerServing;
+        vector<pair<Date, string>> months; // month and segment path
+        atomic<size_t> nextMonth{0};
+        atomic<size_t> runningWorkers{0};
+        mutex claimLock; // orders segment writes against the diary loading months
+        condition_variable claimReleased;
+        set<Date> writingMonths; // segments a worker is rewriting right now
+        set<Date> loadedMonths;  // loaded meanwhile, so repriced in memory instead
+        mutex resultLock;
+        vector<RepricedMonth> results; // months whose segment was rewritten
+        RepriceReport report;          // changes already applied
+        vector<thread> workers;
+        bool quiet = false; // applied without printing, for diaries nobody is viewing
+    };
+    unique_ptr<RepriceJob> repriceJob;
+
+    static string segmentDirFor(const string &logPath)
+    {
+        const string extension = ".json";
+        if (logPath.size() > extension.size() &&
+            logPath.compare(logPath.size() - extension.size(), extension.size(), extension) == 0)
+        {
+            return logPath.substr(0, logPath.size() - extension.size());
+        }
+        return logPath + ".d";
+    }
+
+    string manifestPath() const { return segmentDir + "/manifest.json"; }
+
+    string segmentPath(Date month) const
+    {
+        return segmentDir + "/" + month.toString().substr(0, 7) + ".json";
+    }
+
+    // Mirrors a day's running total into the range tree after its entries change
+    void syncDailyTotal(Date date)
+    {
+        setDailyTotal(date, dailyLogs.dayTotal(date), dailyLogs.hasDay(date));
+    }
+
+    void setDailyTotal(Date date, double total, bool logged)
+    {
+        calorieTree.set(date, total, logged);
+        if (!totalsChanged || date < totalsChangedFrom)
+        {
+            totalsChangedFrom = date;
+        }
+        totalsChanged = true;
+    }
+
+    static json dayToJson(const DiaryColumnStore &store, DiaryColumnStore::Slice slice)
+    {
+        json dateEntries = json::array();
+        for (size_t pos = slice.begin; pos < slice.end; pos++)
+        {
+            if (!store.isLive(pos))
+                continue;
+            json entryJson;
+            entryJson["food"] = store.foodNameAt(pos);
+            entryJson["servings"] = store.servingsAt(pos);
+            entryJson["calories"] = store.caloriesAt(pos);
+            dateEntries.push_back(entryJson);
+        }
+        return dateEntries;
+    }
+
+    // Replaces a day's entries with the given JSON array
+    void loadDay(Date date, const json &entries)
+    {
+        dailyLogs.eraseDay(date);
+        Instrumentation::count(Instrumentation::DIARY_ENTRIES_PARSED, entries.size());
+        for (const auto &entry : entries)
+        {
+            string foodName = entry["food"];
+            double servings = entry["servings"];
+            double calories = entry["calories"];
+            dailyLogs.append(date, dailyLogs.internFood(foodName), servings, calories);
+        }
+    }
+
+    // Reads a date-keyed JSON object of entry arrays into the store
+    void loadDays(const json &days)
+    {
+        for (auto &[dateKey, entries] : days.items())
+        {
+            Date date;
+            if (!Date::parse(dateKey, date))
+            {
+                cerr << "Skipping log entries with invalid date: " << dateKey << endl;
+                continue;
+            }
+            loadDay(date, entries);
+        }
+    }
+
+    void ensureMonthLoaded(Date date)
+    {
+        Date month = date.firstOfMonth();
+        if (!loadedMonths.insert(month).second || manifestMonths.find(month) == manifestMonths.end())
+        {
+            return;
+        }
+        if (repriceJob)
+        {
+            // Read the month either before a re-pricing worker rewrites it or after
+            unique_lock<mutex> guard(repriceJob->claimLock);
+            repriceJob->claimReleased.wait(guard, [&]
+                                           { return repriceJob->writingMonths.count(month) == 0; });
+            repriceJob->loadedMonths.insert(month);
+        }
+
+        try
+        {
+            ifstream file(segmentPath(month));
+            if (!file.is_open())
+            {
+                cerr << "Missing diary segment: " << segmentPath(month) << endl;
+                return;
+            }
+            json j;
+            file >> j;
+            Instrumentation::countFile(Instrumentation::BYTES_READ, segmentPath(month));
+            loadDays(j);
+        }
+        catch (const exception &e)
+        {
+            cerr << "Error loading diary segment " << segmentPath(month) << ": " << e.what() << endl;
+        }
+    }
+
+    void ensureRangeLoaded(Date fromDate, Date toDate)
+    {
+        for (auto it = manifestMonths.lower_bound(fromDate.firstOfMonth());
+             it != manifestMonths.end() && it->first <= toDate; ++it)
+        {
+            ensureMonthLoaded(it->first);
+        }
+    }
+
+    void applyJournalRecord(const json &record)
+    {
+        // Records touching several days (bulk imports) carry a date-keyed object
+        if (record.contains("days"))
+        {
+            for (auto &[dateKey, entries] : record["days"].items())
+            {
+                applyJournalRecord(json{{"date", dateKey}, {"entries", entries}});
+            }
+            return;
+        }
+
+        Date date;
+        if (!Date::parse(record["date"].get<string>(), date))
+        {
+            throw runtime_error("invalid date " + record["date"].get<string>());
+        }
+        ensureMonthLoaded(date);
+        loadDay(date, record["entries"]);
+        dirtyMonths.insert(date.firstOfMonth());
+        dirty.markDirty();
+    }
+
+    // Range tree from the manifest for months on disk, from the store for loaded ones
+    void rebuildCalorieTree()
+    {
+        calorieTree.clear();
+        for (const auto &[month, info] : manifestMonths)
+        {
+            if (loadedMonths.count(month))
+                continue;
+            for (auto &[dateKey, total] : info["days"].items())
+            {
+                Date date;
+                if (Date::parse(dateKey, date))
+                    calorieTree.set(date, total.get<double>());
+            }
+        }
+        for (size_t d = 0; d < dailyLogs.dayCount(); d++)
+        {
+            calorieTree.set(dailyLogs.dayAt(d), dailyLogs.totalAt(d), dailyLogs.liveCountAt(d) > 0);
+        }
+    }
+
+    // Records the current state of the given days in the journal, or notes them for
+    // the next commitJournal() under group commit
+    void journalDays(const vector<Date> &dates)
+    {
+        dirty.markDirty();
+        if (groupCommit)
+        {
+            pendingJournalDays.insert(dates.begin(), dates.end());
+            return;
+        }
+        writeJournalRecord(dates);
+    }
+
+    // Several days go into a single record, so they are replayed all together or
+    // not at all
+    void writeJournalRecord(const vector<Date> &dates)
+    {
+        json record;
+        if (dates.size() == 1)
+        {
+            record["date"] = dates.front().toString();
+            record["entries"] = dayToJson(dailyLogs, dailyLogs.day(dates.front()));
+        }
+        else
+        {
+            record["days"] = json::object();
+            for (Date date : dates)
+            {
+                record["days"][date.toString()] = dayToJson(dailyLogs, dailyLogs.day(date));
+            }
+        }
+        if (!journal.append(record.dump()))
+        {
+            cerr << "Unable to write diary journal: " << journal.getPath() << endl;
+            return;
+        }
+
+        journalRecords += dates.size();
+        if (journalRecords >= journalCompactionThreshold)
+        {
+            compactInBackground();
+        }
+    }
+
+    // Writes a file next to its destination and renames it into place
+    static bool writeFileAtomically(const string &path, const json &j, int indent)
+    {
+        string tempPath = path + ".tmp";
+        ofstream file(tempPath);
+        if (!file.is_open())
+        {
+            cerr << "Unable to open file for writing: " << tempPath << endl;
+            return false;
+        }
+        string text = j.dump(indent);
+        file << text;
+        file.close();
+        if (!file)
+        {
+            cerr << "Unable to write file: " << tempPath << endl;
+            return false;
+        }
+        Instrumentation::count(Instrumentation::BYTES_WRITTEN, text.size());
+
+        int fd = ::open(tempPath.c_str(), O_RDONLY);
+        if (fd >= 0)
+        {
+            ::fsync(fd);
+            ::close(fd);
+        }
+        return rename(tempPath.c_str(), path.c_str()) == 0;
+    }
+
+    // Captures the dirty months and refreshes their manifest entries
+    vector<SegmentSnapshot> snapshotDirtyMonths()
+    {
+        vector<SegmentSnapshot> segments;
+        for (Date month : dirtyMonths)
+        {
+            SegmentSnapshot segment{segmentPath(month), json::object()};
+            json dayTotals = json::object();
+            size_t entryCount = 0;
+            double monthTotal = 0.0;
+
+            Date monthEnd = month.lastOfMonth();
+            for (size_t d = 0; d < dailyLogs.dayCount(); d++)
+            {
+                Date date = dailyLogs.dayAt(d);
+                if (date < month || date > monthEnd || dailyLogs.liveCountAt(d) == 0)
+                    continue;
+                segment.days[date.toString()] = dayToJson(dailyLogs, dailyLogs.sliceAt(d));
+                dayTotals[date.toString()] = dailyLogs.totalAt(d);
+                entryCount += dailyLogs.liveCountAt(d);
+                monthTotal += dailyLogs.totalAt(d);
+            }
+
+            if (entryCount == 0)
+            {
+                manifestMonths.erase(month);
+                segment.days = json();
+            }
+            else
+            {
+                manifestMonths[month] = json{{"entries", entryCount}, {"calories", monthTotal}, {"days", dayTotals}};
+            }
+            segments.push_back(move(segment));
+        }
+        dirtyMonths.clear();
+        return segments;
+    }
+
+    json manifestToJson() const
+    {
+        json months = json::object();
+        for (const auto &[month, info] : manifestMonths)
+        {
+            months[month.toString().substr(0, 7)] = info;
+        }
+        return json{{"version", 1}, {"months", months}};
+    }
+
+    static bool writeSegments(const vector<SegmentSnapshot> &segments, const json &manifest, const string &manifestFile)
+    {
+        bool ok = true;
+        for (const auto &segment : segments)
+        {
+            if (segment.days.is_null())
+            {
+                remove(segment.path.c_str());
+            }
+            else
+            {
+                ok = writeFileAtomically(segment.path, segment.days, 4) && ok;
+            }
+        }
+        // The manifest goes last so it never lists a segment that was not written
+        return ok && writeFileAtomically(manifestFile, manifest, 4);
+    }
+
+    // Waits for the compaction thread; returns false if its write failed. The
+    // months it was writing are then dirty again, so the rotated journal holding
+    // their records is kept until a later compaction has written them all.
+    bool joinCompaction()
+    {
+        if (compactionThread.joinable())
+        {
+            compactionThread.join();
+        }
+        if (!compactionFailed)
+        {
+            return true;
+        }
+        compactionFailed = false;
+        dirtyMonths.insert(compactingMonths.begin(), compactingMonths.end());
+        return false;
+    }
+
+    // Writes the dirty months and the manifest on a background thread. The journal
+    // is rotated first, so new changes keep landing in a fresh one meanwhile. While
+    // a compaction is still writing, the journal simply keeps growing and the next
+    // record past the threshold tries again, so callers never wait on the disk.
+    // Returns false if no compaction could be started.
+    bool compactInBackground()
+    {
+        if (compactionRunning)
+        {
+            return false;
+        }
+        joinCompaction();
+        if (!journal.rotate())
+        {
+            cerr << "Unable to rotate diary journal: " << journal.getPath() << endl;
+            return false;
+        }
+        journalRecords = 0;
+
+        // The snapshot refreshes the manifest entries, so it must come first
+        DirtyTracker::Snapshot saving = dirty.beginSave();
+        compactingMonths.assign(dirtyMonths.begin(), dirtyMonths.end());
+        vector<SegmentSnapshot> segments = snapshotDirtyMonths();
+        json manifest = manifestToJson();
+        compactionRunning = true;
+        compactionThread = thread([this, saving, segments = move(segments), manifest = move(manifest),
+                                   manifestFile = manifestPath(), rotated = journal.getRotatedPath()]()
+                                  {
+                                      if (writeSegments(segments, manifest, manifestFile))
+                                      {
+                                          remove(rotated.c_str());
+                                          dirty.markSaved(saving);
+                                      }
+                                      else
+                                      {
+                                          compactionFailed = true;
+                                      }
+                                      compactionRunning = false;
+                                  });
+        return true;
+    }
+
+    // Worker body: reprices whole segment files, one month at a time
+    static void repriceSegments(RepriceJob &job)
+    {
+        vector<RepricedMonth> repriced;
+        for (size_t i; (i = job.nextMonth++) < job.months.size();)
+        {
+            const auto &[month, path] = job.months[i];
+            json days;
+            try
+            {
+                ifstream file(path);
+                file >> days;
+            }
+            catch (const exception &e)
+            {
+                cerr << "Error reading diary segment " << path << ": " << e.what() << endl;
+                continue;
+            }
+
+            RepriceReport changes;
+            for (auto &[dateKey, entries] : days.items())
+            {
+                for (json &entry : entries)
+                {
+                    auto price = job.caloriesPerServing.find(entry["food"].get<string>());
+                    if (price == job.caloriesPerServing.end())
+                        continue;
+                    double oldCalories = entry["calories"].get<double>();
+                    double newCalories = price->second * entry["servings"].get<double>();
+                    if (newCalories == oldCalories)
+                        continue;
+                    entry["calories"] = newCalories;
+                    RepriceDelta &delta = changes[price->first];
+                    delta.entries++;
+                    delta.oldCalories += oldCalories;
+                    delta.newCalories += newCalories;
+                }
+            }
+            if (changes.empty())
+                continue;
+
+            // A month the diary has loaded meanwhile may already carry newer
+            // entries, so only a month still on disk alone is rewritten
+            {
+                lock_guard<mutex> guard(job.claimLock);
+                if (job.loadedMonths.count(month))
+                    continue;
+                job.writingMonths.insert(month);
+            }
+            bool written = writeFileAtomically(path, days, 4);
+            {
+                lock_guard<mutex> guard(job.claimLock);
+                job.writingMonths.erase(month);
+            }
+            job.claimReleased.notify_all();
+            if (!written)
+            {
+                cerr << "Unable to write repriced diary segment " << path << endl;
+                continue;
+            }
+            repriced.push_back(RepricedMonth{month, SegmentSnapshot{path, move(days)}, move(changes)});
+        }
+
+        lock_guard<mutex> guard(job.resultLock);
+        move(repriced.begin(), repriced.end(), back_inserter(job.results));
+        job.runningWorkers--;
+    }
+
+    // Reprices the loaded entries of the given foods through the food-to-entry
+    // index. Removed entries are repriced too, so an undo brings back current values.
+    void repriceLoadedEntries(const map<string, double> &caloriesPerServing, RepriceReport &report)
+    {
+        set<Date> touched;
+        for (const auto &[name, perServing] : caloriesPerServing)
+        {
+            uint32_t foodId;
+            if (!dailyLogs.findFood(name, foodId))
+                continue;
+            dailyLogs.forEachEntryOf(foodId, [&](size_t pos)
+                                     {
+                                         double oldCalories = dailyLogs.caloriesAt(pos);
+                                         double newCalories = perServing * dailyLogs.servingsAt(pos);
+                                         if (newCalories == oldCalories)
+                                             return;
+                                         if (dailyLogs.isLive(pos))
+                                         {
+                                             RepriceDelta &delta = report[name];
+                                             delta.entries++;
+                                             delta.oldCalories += oldCalories;
+                                             delta.newCalories += newCalories;
+                                             touched.insert(dailyLogs.dateAt(pos));
+                                         }
+                                         dailyLogs.setCalories(pos, newCalories); });
+        }
+        if (!touched.empty())
+        {
+            daysChanged(vector<Date>(touched.begin(), touched.end()));
+        }
+    }
+
+    static void printRepriceReport(const RepriceReport &report)
+    {
+        size_t entries = 0;
+        double delta = 0.0;
+        for (const auto &[name, change] : report)
+        {
+            entries += change.entries;
+            delta += change.newCalories - change.oldCalories;
+        }
+        cout << "\nRe-pricing finished: " << entries << " entries changed, " << showpos << delta
+             << noshowpos << " calories in total." << endl;
+        for (const auto &[name, change] : report)
+        {
+            cout << "  " << setw(30) << left << name << setw(8) << right << change.entries << " entries  "
+                 << change.oldCalories << " -> " << change.newCalories << " calories" << endl;
+        }
+    }
+
+    // Reads the old single-file log (and its journals) and splits it into segments
+    void migrateLegacyLog()
+    {
+        ifstream file(logFile);
+        json j;
+        file >> j;
+        file.close();
+        Instrumentation::countFile(Instrumentation::BYTES_READ, logFile);
+        loadDays(j);
+
+        auto apply = [this](const json &record)
+        {
+            Date date;
+            if (Date::parse(record["date"].get<string>(), date))
+                loadDay(date, record["entries"]);
+        };
+        DiaryJournal::replay(logFile + ".journal.compacting", apply);
+        DiaryJournal::replay(logFile + ".journal", apply);
+
+        for (size_t d = 0; d < dailyLogs.dayCount(); d++)
+        {
+            loadedMonths.insert(dailyLogs.dayAt(d).firstOfMonth());
+            dirtyMonths.insert(dailyLogs.dayAt(d).firstOfMonth());
+        }
+
+        vector<SegmentSnapshot> segments = snapshotDirtyMonths();
+        if (writeSegments(segments, manifestToJson(), manifestPath()))
+        {
+            rename(logFile.c_str(), (logFile + ".migrated").c_str());
+            remove((logFile + ".journal").c_str());
+            remove((logFile + ".journal.compacting").c_str());
+            cout << "Migrated " << logFile << " into monthly segments under " << segmentDir << endl;
+        }
+    }
+
+    // Every diary change goes through these, keeping totals and journal in step
+    EntryId insertEntry(Date date, size_t indexInDay, uint32_t foodId, double servings, double calories)
+    {
+        ensureMonthLoaded(date);
+        EntryId id = dailyLogs.insert(date, indexInDay, foodId, servings, calories);
+        entryChanged(date);
+        return id;
+    }
+
+    // Removing and restoring by id are exact: they touch that entry and nothing else
+    bool removeEntry(Date date, EntryId id)
+    {
+        ensureMonthLoaded(date);
+        if (!dailyLogs.remove(id))
+            return false;
+        entryChanged(date);
+        purgeTombstones(date, id);
+        return true;
+    }
+
+    bool restoreEntry(Date date, EntryId id)
+    {
+        ensureMonthLoaded(date);
+        if (!dailyLogs.restore(id))
+            return false;
+        entryChanged(date);
+        return true;
+    }
+
+    void entryChanged(Date date)
+    {
+        daysChanged({date});
+    }
+
+    void daysChanged(const vector<Date> &dates)
+    {
+        for (Date date : dates)
+        {
+            dirtyMonths.insert(date.firstOfMonth());
+            syncDailyTotal(date);
+        }
+        journalDays(dates);
+    }
+
+    // Removes or restores every entry of an import batch, journaling the days once
+    bool setBatchLive(uint32_t batch, bool restore)
+    {
+        auto it = importBatches.find(batch);
+        if (it == importBatches.end())
+            return false;
+
+        vector<Date> touched;
+        for (const auto &[date, ids] : it->second)
+        {
+            bool changed = false;
+            for (EntryId id : ids)
+                changed = (restore ? dailyLogs.restore(id) : dailyLogs.remove(id)) || changed;
+            if (changed)
+                touched.push_back(date);
+        }
+        if (touched.empty())
+            return false;
+        daysChanged(touched);
+        return true;
+    }
+
+    // Records a command; an import batch is forgotten once its command leaves
+    // the history, since nothing can undo or redo it any more
+    void pushHistory(const DiaryCommand &command)
+    {
+        history.push(command, [this](const DiaryCommand &dropped)
+                     { forgetImportBatch(dropped); });
+    }
+
+    void forgetImportBatch(const DiaryCommand &command)
+    {
+        if (command.kind == DiaryCommand::Kind::IMPORT)
+            importBatches.erase(command.foodId);
+    }
+
+    // Drops a day's removed entries once they outnumber the live ones. Entries the
+    // undo history still refers to stay, so their ids remain restorable.
+    void purgeTombstones(Date date, EntryId justRemoved)
+    {
+        if (dailyLogs.tombstones(date) <= max<size_t>(64, dailyLogs.liveCount(date)))
+            return;
+
+        vector<EntryId> pinned{justRemoved};
+        auto pin = [&](const DiaryCommand &command)
+        {
+            if (command.kind != DiaryCommand::Kind::IMPORT)
+            {
+                if (command.date == date)
+                    pinned.push_back(command.entry);
+                return;
+            }
+            auto batch = importBatches.find(command.foodId);
+            if (batch == importBatches.end())
+                return;
+            auto day = batch->second.find(date);
+            if (day != batch->second.end())
+                pinned.insert(pinned.end(), day->second.begin(), day->second.end());
+        };
+        for (size_t i = 0; i < history.undoSize(); i++)
+            pin(history.undoAt(i));
+        for (size_t i = 0; i < history.redoSize(); i++)
+            pin(history.redoAt(i));
+
+        auto byId = [](EntryId a, EntryId b)
+        { return a.index != b.index ? a.index < b.index : a.generation < b.generation; };
+        sort(pinned.begin(), pinned.end(), byId);
+        dailyLogs.purgeDay(date, [&](EntryId id)
+                           { return binary_search(pinned.begin(), pinned.end(), id, byId); });
+    }
+
+public:
+    FoodDiary(FoodDatabaseManager &db, const string &log)
+        : logFile(log), currentDate(DateUtil::getCurrentDate()), dbManager(db),
+          segmentDir(segmentDirFor(log)), journal(segmentDir + "/changes.journal"), journalRecords(0)
+    {
+        setHistoryLimits(defaultHistoryEntries, defaultHistoryBytes);
+        loadLogs();
+        if (!journal.open())
+        {
+            cerr << "Unable to open diary journal: " << journal.getPath() << endl;
+        }
+        if (journalRecords > 0)
+        {
+            compactInBackground();
+        }
+    }
+
+    // Brings historical entries of the given foods in line with their new
+    // per-serving calories. Loaded months are updated at once; the months on disk
+    // are repriced by worker threads, one month per task, while the diary stays
+    // usable. Call pollRepricing to apply and report the result.
+    void startRepricing(const map<string, double> &caloriesPerServing, bool quiet = false)
+    {
+        finishRepricing(); // one pass at a time
+        if (caloriesPerServing.empty())
+            return;
+
+        auto job = make_unique<RepriceJob>();
+        job->caloriesPerServing = caloriesPerServing;
+        job->quiet = quiet;
+        repriceLoadedEntries(caloriesPerServing, job->report);
+        for (const auto &[month, info] : manifestMonths)
+        {
+            if (!loadedMonths.count(month))
+                job->months.emplace_back(month, segmentPath(month));
+        }
+
+        size_t workerCount = min<size_t>(job->months.size(), max(1u, thread::hardware_concurrency()));
+        job->runningWorkers = workerCount;
+        for (size_t i = 0; i < workerCount; i++)
+        {
+            job->workers.emplace_back(repriceSegments, ref(*job));
+        }
+        if (workerCount > 0 && !quiet)
+        {
+            cout << "Re-pricing " << job->months.size() << " stored months in the background." << endl;
+        }
+        repriceJob = move(job);
+        pollRepricing();
+    }
+
+    // Swaps in a finished re-pricing pass and prints its deltas; returns false
+    // while the workers, or a compaction that would race the manifest, still run.
+    // The segments are already written; the manifest follows through a compaction.
+    bool pollRepricing()
+    {
+        if (!repriceJob || repriceJob->runningWorkers > 0 || compactionRunning)
+            return false;
+        for (thread &worker : repriceJob->workers)
+        {
+            worker.join();
+        }
+
+        for (RepricedMonth &result : repriceJob->results)
+        {
+            // A month loaded after its rewrite holds the same entries as the file
+            json dayTotals = json::object();
+            size_t entryCount = 0;
+            double monthTotal = 0.0;
+            for (auto &[dateKey, entries] : result.segment.days.items())
+            {
+                double total = 0.0;
+                for (const json &entry : entries)
+                    total += entry["calories"].get<double>();
+                dayTotals[dateKey] = total;
+                entryCount += entries.size();
+                monthTotal += total;
+
+                Date date;
+                if (Date::parse(dateKey, date))
+                    setDailyTotal(date, total, !entries.empty());
+            }
+            manifestMonths[result.month] = json{{"entries", entryCount}, {"calories", monthTotal}, {"days", dayTotals}};
+
+            for (const auto &[name, change] : result.changes)
+            {
+                RepriceDelta &delta = repriceJob->report[name];
+                delta.entries += change.entries;
+                delta.oldCalories += change.oldCalories;
+                delta.newCalories += change.newCalories;
+            }
+        }
+        repriceLoadedEntries(repriceJob->caloriesPerServing, repriceJob->report);
+
+        if (!repriceJob->results.empty() && !compactInBackground())
+        {
+            cerr << "Unable to write the repriced diary manifest under " << segmentDir << endl;
+        }
+
+        if (!repriceJob->quiet)
+        {
+            printRepriceReport(repriceJob->report);
+        }
+        repriceJob.reset();
+        return true;
+    }
+
+    // Waits for a running re-pricing pass and applies it
+    void finishRepricing()
+    {
+        if (!repriceJob)
+            return;
+        for (thread &worker : repriceJob->workers)
+        {
+            worker.join();
+        }
+        repriceJob->workers.clear();
+        joinCompaction();
+        pollRepricing();
+    }
+
+    ~FoodDiary()
+    {
+        finishRepricing();
+
+        // Everything is on disk through the journal once changes left pending under
+        // group commit are written; then only wait for a running compaction
+        commitJournal();
+        joinCompaction();
+    }
+
+    // Log operations: the manifest, then journal records not yet in the segments.
+    // Segment files themselves are read on demand.
+    void loadLogs()
+    {
+        ScopedTimer timer(Instrumentation::LOAD_LOGS);
+        try
+        {
+            filesystem::create_directories(segmentDir);
+
+            ifstream manifestFile(manifestPath());
+            if (manifestFile.is_open())
+            {
+                json manifest;
+                manifestFile >> manifest;
+                Instrumentation::countFile(Instrumentation::BYTES_READ, manifestPath());
+                for (auto &[monthKey, info] : manifest["months"].items())
+                {
+                    Date month;
+                    if (Date::parse(monthKey + "-01", month))
+                        manifestMonths[month] = info;
+                }
+            }
+            else if (ifstream(logFile).is_open())
+            {
+                migrateLegacyLog();
+            }
+            else
+            {
+                cout << "No existing log file found. Creating a new one." << endl;
+            }
+
+            auto apply = [this](const json &record)
+            { applyJournalRecord(record); };
+            journalRecords = DiaryJournal::replay(journal.getRotatedPath(), apply) +
+                             DiaryJournal::replay(journal.getPath(), apply);
+
+            rebuildCalorieTree();
+
+            cout << "Indexed food logs for " << manifestMonths.size() << " months." << endl;
+        }
+        catch (const exception &e)
+        {
+            cerr << "Error loading logs: " << e.what() << endl;
+        }
+    }
+
+    // Writes every dirty month now and empties the journal. A compaction that is
+    // already running is finished first, since it only covers older changes. If
+    // the write fails the diary stays dirty and the journal keeps the changes.
+    bool saveLogs(bool quiet = false)
+    {
+        ScopedTimer timer(Instrumentation::SAVE_LOGS);
+        joinCompaction();
+        if (!compactInBackground() || !joinCompaction())
+        {
+            cerr << "Unable to save logs under " << segmentDir << "; changes remain in the journal." << endl;
+            return false;
+        }
+        if (!quiet)
+        {
+            cout << "Logs saved successfully." << endl;
+        }
+        return true;
+    }
+
+    // Changes count as unsaved until they are folded into the month segments;
+    // they are already durable through the journal (or at the next commitJournal)
+    DirtyTracker &dirtyTracker() { return dirty; }
+
+    // Date management
+    void setCurrentDate(const string &dateStr)
+    {
+        Date date;
+        if (Date::parse(dateStr, date))
+        {
+            currentDate = date;
+            cout << "Current date set to: " << currentDate << endl;
+        }
+        else
+        {
+            cerr << "Invalid date. Please use YYYY-MM-DD with a year from " << Date::MIN_YEAR << " to "
+                 << Date::MAX_YEAR << "." << endl;
+        }
+    }
+
+    Date getCurrentDate() const
+    {
+        return currentDate;
+    }
+
+    // Log display; TSV and JSON list the entries without the header and total
+    void displayDailyLog(Date date, OutputFormat format = OutputFormat::TABLE)
+    {
+        ensureMonthLoaded(date);
+        DiaryColumnStore::Slice slice = dailyLogs.day(date);
+        ListingRenderer out(format, {"date", "no", "food", "servings", "calories"});
+        string day = date.toString();
+        if (!dailyLogs.hasDay(date))
+        {
+            if (out.isTable())
+                out << "No food entries for " << day << '\n';
+            return;
+        }
+
+        if (out.isTable())
+        {
+            out << "\nFood Log for " << day << ":\n";
+            out.field("No.", 5).field("Food", 30).field("Servings", 15).field("Calories", 15, true) << '\n';
+            out << string(65, '-') << '\n';
+        }
+
+        int count = 1;
+        for (size_t pos = slice.begin; pos < slice.end; pos++)
+        {
+            if (!dailyLogs.isLive(pos))
+                continue;
+            if (out.isTable())
+            {
+                out.field(count++, 5)
+                    .field(dailyLogs.foodNameAt(pos), 30)
+                    .field(dailyLogs.servingsAt(pos), 15)
+                    .field(dailyLogs.caloriesAt(pos), 15, true)
+                    << '\n';
+            }
+            else
+            {
+                out.row(day, count++, dailyLogs.foodNameAt(pos), dailyLogs.servingsAt(pos), dailyLogs.caloriesAt(pos));
+            }
+        }
+
+        if (out.isTable())
+        {
+            out << string(65, '-') << '\n';
+            out.field("Total Calories:", 50).field(getTotalCaloriesForDate(date), 15, true) << "\n\n";
+        }
+    }
+
+
+    // Re-applies a recorded change. Both directions address the entry by id, so
+    // undo and redo hit exactly the entry the change touched, wherever it sits.
+    bool apply(const DiaryCommand &command)
+    {
+        if (command.kind == DiaryCommand::Kind::IMPORT)
+            return setBatchLive(command.foodId, true);
+        if (command.kind == DiaryCommand::Kind::ADD)
+            return restoreEntry(command.date, command.entry);
+        return removeEntry(command.date, command.entry);
+    }
+
+    bool revert(const DiaryCommand &command)
+    {
+        if (command.kind == DiaryCommand::Kind::IMPORT)
+            return setBatchLive(command.foodId, false);
+        if (command.kind == DiaryCommand::Kind::ADD)
+            return removeEntry(command.date, command.entry);
+        return restoreEntry(command.date, command.entry);
+    }
+
+    // Carries out a command and adds it to the history without printing. An ADD is
+    // carried out here because its entry id only exists once the entry has been
+    // inserted; false if a DELETE's entry no longer exists.
+    bool runCommand(DiaryCommand &command)
+    {
+        if (command.kind == DiaryCommand::Kind::ADD)
+        {
+            command.entry = insertEntry(command.date, DiaryColumnStore::npos, command.foodId,
+                                        command.servings, command.calories);
+        }
+        else if (!removeEntry(command.date, command.entry))
+        {
+            return false;
+        }
+        pushHistory(command);
+        return true;
+    }
+
+    // Command execution with undo support
+    void executeCommand(DiaryCommand command)
+    {
+        if (!runCommand(command))
+        {
+            cerr << "Entry no longer exists." << endl;
+            return;
+        }
+        cout << "Executed: " << command.getDescription(dailyLogs) << endl;
+    }
+
+    DiaryCommand deleteCommandAt(size_t pos) const
+    {
+        return DiaryCommand{DiaryCommand::Kind::DELETE, dailyLogs.dateAt(pos), dailyLogs.idAt(pos),
+                            dailyLogs.foodIdAt(pos), dailyLogs.servingsAt(pos), dailyLogs.caloriesAt(pos)};
+    }
+
+    void recordCommand(const DiaryCommand &command)
+    {
+        pushHistory(command);
+        cout << "Executed: " << command.getDescription(dailyLogs) << endl;
+    }
+
+    // Undoes the last command without printing. Returns its description, or an
+    // empty string when there is nothing to undo; applied is false when the
+    // command's entry no longer exists.
+    string undoLast(bool &applied)
+    {
+        const DiaryCommand *command = history.undo();
+        if (!command)
+        {
+            applied = false;
+            return "";
+        }
+        applied = revert(*command);
+        return command->getDescription(dailyLogs);
+    }
+
+    void undo()
+    {
+        bool applied;
+        string description = undoLast(applied);
+        if (description.empty())
+        {
+            cout << "Nothing to undo." << endl;
+            return;
+        }
+
+        if (!applied)
+        {
+            cout << "Skipped: " << description << " (entry no longer exists)" << endl;
+            return;
+        }
+        cout << "Undone: " << description << endl;
+    }
+
+    void redo()
+    {
+        const DiaryCommand *command = history.redo();
+        if (!command)
+        {
+            cout << "Nothing to redo." << endl;
+            return;
+        }
+
+        if (!apply(*command))
+        {
+            cout << "Skipped: " << command->getDescription(dailyLogs) << " (entry no longer exists)" << endl;
+            return;
+        }
+        cout << "Redone: " << command->getDescription(dailyLogs) << endl;
+    }
+
+    // Caps the undo history by entry count and by memory; the tighter bound wins
+    void setHistoryLimits(size_t maxEntries, size_t maxBytes)
+    {
+        history.setCapacity(min(maxEntries, maxBytes / sizeof(DiaryCommand)), [this](const DiaryCommand &dropped)
+                            { forgetImportBatch(dropped); });
+    }
+
+    // Food entry management
+    void addFood(Date date, const string &foodName, double servings)
+    {
+        auto it = dbManager.getFood(foodName);
+        if (!it)
+        {
+            cerr << "Food not found: " << foodName << endl;
+            return;
+        }
+
+        // Calculate calories based on food definition
+        DiaryCommand command{DiaryCommand::Kind::ADD, date, EntryId(), dailyLogs.internFood(foodName),
+                             servings, it->getCalories() * servings};
+        executeCommand(command);
+    }
+
+    // Same as addFood without printing, for scripted use. Returns the calories
+    // logged, or a negative value for an unknown food. Throws invalid_argument
+    // unless servings is a positive number, as addFoodToLog requires.
+    double logFood(Date date, const string &foodName, double servings)
+    {
+        if (!(servings > 0) || !isfinite(servings))
+        {
+            throw invalid_argument("servings must be a positive number");
+        }
+        auto food = dbManager.getFood(foodName);
+        if (!food)
+        {
+            return -1.0;
+        }
+        DiaryCommand command{DiaryCommand::Kind::ADD, date, EntryId(), dailyLogs.internFood(foodName),
+                             servings, food->getCalories() * servings};
+        runCommand(command);
+        return command.calories;
+    }
+
+    // Same as deleteFood without printing; false if the day has no such entry
+    bool deleteEntryAt(Date date, size_t index)
+    {
+        ensureMonthLoaded(date);
+        size_t pos = dailyLogs.livePosition(date, index);
+        if (pos == DiaryColumnStore::npos)
+        {
+            return false;
+        }
+        DiaryCommand command = deleteCommandAt(pos);
+        return runCommand(command);
+    }
+
+    // Live entries on a day, the range of valid indexes for deleteFood
+    size_t entryCount(Date date)
+    {
+        ensureMonthLoaded(date);
+        return dailyLogs.liveCount(date);
+    }
+
+    // Deletes the index-th entry of a day as listed by displayDailyLog
+    void deleteFood(Date date, size_t index)
+    {
+        ensureMonthLoaded(date);
+        size_t pos = dailyLogs.livePosition(date, index);
+        if (pos == DiaryColumnStore::npos)
+        {
+            cerr << "Invalid food entry index." << endl;
+            return;
+        }
+        deleteEntry(dailyLogs.idAt(pos));
+    }
+
+    // Deletes an entry by its stable id; stale ids are rejected
+    void deleteEntry(EntryId id)
+    {
+        size_t pos = dailyLogs.positionOf(id);
+        if (pos == DiaryColumnStore::npos || !dailyLogs.isLive(pos))
+        {
+            cerr << "Invalid food entry." << endl;
+            return;
+        }
+
+        // Store the entry for potential undo
+        executeCommand(deleteCommandAt(pos));
+    }
+
+    // Calls emit(date, food, servings, calories) for every live entry dated within
+    // [from, to], in date order. Loaded months come from the store; the others are
+    // read straight from their segment file one month at a time and never loaded.
+    template <typename Emit>
+    void forEachEntry(Date fromDate, Date toDate, Emit emit)
+    {
+        set<Date> months;
+        for (auto it = manifestMonths.lower_bound(fromDate.firstOfMonth());
+             it != manifestMonths.end() && it->first <= toDate; ++it)
+        {
+            months.insert(it->first);
+        }
+        for (size_t d = 0; d < dailyLogs.dayCount(); d++)
+        {
+            if (dailyLogs.dayAt(d) >= fromDate && dailyLogs.dayAt(d) <= toDate)
+                months.insert(dailyLogs.dayAt(d).firstOfMonth());
+        }
+
+        for (Date month : months)
+        {
+            if (loadedMonths.count(month))
+            {
+                DiaryColumnStore::Slice slice = dailyLogs.range(max(month, fromDate), min(month.lastOfMonth(), toDate));
+                for (size_t pos = slice.begin; pos < slice.end; pos++)
+                {
+                    if (dailyLogs.isLive(pos))
+                        emit(dailyLogs.dateAt(pos), dailyLogs.foodNameAt(pos),
+                             dailyLogs.servingsAt(pos), dailyLogs.caloriesAt(pos));
+                }
+                continue;
+            }
+
+            json segment;
+            try
+            {
+                ifstream file(segmentPath(month));
+                file >> segment;
+            }
+            catch (const exception &e)
+            {
+                cerr << "Error reading diary segment " << segmentPath(month) << ": " << e.what() << endl;
+                continue;
+            }
+            // Object keys are kept sorted, and YYYY-MM-DD sorts chronologically
+            for (auto &[dateKey, entries] : segment.items())
+            {
+                Date date;
+                if (!Date::parse(dateKey, date) || date < fromDate || date > toDate)
+                    continue;
+                for (const json &entry : entries)
+                {
+                    emit(date, entry["food"].get<string>(), entry["servings"].get<double>(),
+                         entry["calories"].get<double>());
+                }
+            }
+        }
+    }
+
+    // Streams the diary entries within [from, to] to CSV or to the columnar format
+    bool exportEntries(const string &path, Date fromDate, Date toDate)
+    {
+        size_t rows = 0;
+        bool written;
+        if (isCsvPath(path))
+        {
+            CsvWriter writer(path);
+            if (!writer.isOpen())
+            {
+                cout << "Error: Unable to open file for writing." << endl;
+                return false;
+            }
+            writer.field("date").field("food").field("servings").field("calories").endRow();
+            forEachEntry(fromDate, toDate, [&](Date date, const string &food, double servings, double calories)
+                         {
+                             writer.field(date.toString()).field(food).field(servings).field(calories).endRow();
+                             rows++; });
+            written = writer.close();
+        }
+        else
+        {
+            using Type = ColumnarWriter::ColumnType;
+            ColumnarWriter writer(path, {{"date", Type::DAY}, {"food", Type::DICTIONARY},
+                                         {"servings", Type::DOUBLE}, {"calories", Type::DOUBLE}});
+            if (!writer.isOpen())
+            {
+                cout << "Error: Unable to open file for writing." << endl;
+                return false;
+            }
+            forEachEntry(fromDate, toDate, [&](Date date, const string &food, double servings, double calories)
+                         {
+                             writer.add(0, date.dayNumber());
+                             writer.add(1, food);
+                             writer.add(2, servings);
+                             writer.add(3, calories);
+                             writer.endRow(); });
+            rows = writer.rows();
+            written = writer.close();
+        }
+
+        if (!written)
+        {
+            cout << "Error writing " << path << endl;
+            return false;
+        }
+        cout << "Exported " << rows << " entries to " << path << endl;
+        return true;
+    }
+
+    // Splits a CSV line into fields; a quoted field may contain commas and "" for a quote
+    static void splitCsvLine(const string &line, vector<string> &fields)
+    {
+        fields.clear();
+        string field;
+        bool quoted = false;
+        for (size_t i = 0; i < line.size(); i++)
+        {
+            char c = line[i];
+            if (quoted)
+            {
+                if (c == '"' && i + 1 < line.size() && line[i + 1] == '"')
+                {
+                    field += '"';
+                    i++;
+                }
+                else if (c == '"')
+                    quoted = false;
+                else
+                    field += c;
+            }
+            else if (c == '"')
+                quoted = true;
+            else if (c == ',')
+                fields.push_back(move(field)), field.clear();
+            else if (c != '\r')
+                field += c;
+        }
+        fields.push_back(move(field));
+    }
+
+    // Imports (date, food, servings) rows from a CSV or JSONL file as one change:
+    // the entries are journaled in a single record and undone in a single step.
+    // Rows are read in chunks whose food names are resolved against the catalog
+    // together. Unknown foods and malformed rows are skipped and reported.
+    bool importEntries(const string &path)
+    {
+        ifstream file(path);
+        if (!file.is_open())
+        {
+            cerr << "Unable to open import file: " << path << endl;
+            return false;
+        }
+
+        bool isJsonl = path.size() >= 6 && path.compare(path.size() - 6, 6, ".jsonl") == 0;
+        vector<DiaryColumnStore::NewEntry> chunk;
+        vector<string> chunkFoods;
+        map<Date, vector<EntryId>> imported;
+        size_t importedCount = 0;
+        set<Date> touched;
+        map<string, size_t> unknownFoods;
+        vector<size_t> malformedLines;
+        size_t malformedCount = 0;
+        double importedCalories = 0.0;
+
+        auto flush = [&]()
+        {
+            vector<shared_ptr<Food>> foods = dbManager.resolveFoods(chunkFoods);
+            vector<DiaryColumnStore::NewEntry> rows;
+            rows.reserve(chunk.size());
+            for (size_t i = 0; i < chunk.size(); i++)
+            {
+                if (!foods[i])
+                {
+                    unknownFoods[chunkFoods[i]]++;
+                    continue;
+                }
+                DiaryColumnStore::NewEntry row = chunk[i];
+                row.foodId = dailyLogs.internFood(chunkFoods[i]);
+                row.calories = foods[i]->getCalories() * row.servings;
+                if (touched.insert(row.date).second)
+                    ensureMonthLoaded(row.date);
+                importedCalories += row.calories;
+                rows.push_back(row);
+            }
+            vector<EntryId> ids = dailyLogs.insertBatch(rows);
+            for (size_t i = 0; i < rows.size(); i++)
+                imported[rows[i].date].push_back(ids[i]);
+            importedCount += ids.size();
+            chunk.clear();
+            chunkFoods.clear();
+        };
+
+        string line;
+        vector<string> fields;
+        size_t lineNumber = 0;
+        while (getline(file, line))
+        {
+            lineNumber++;
+            if (line.find_first_not_of(" \t\r") == string::npos)
+                continue;
+
+            string dateText, foodName;
+            double servings = 0.0;
+            bool valid = false;
+            if (isJsonl)
+            {
+                json row = json::parse(line, nullptr, false);
+                if (row.is_object() && row.contains("date") && row["date"].is_string() &&
+                    row.contains("food") && row["food"].is_string() &&
+                    row.contains("servings") && row["servings"].is_number())
+                {
+                    dateText = row["date"].get<string>();
+                    foodName = row["food"].get<string>();
+                    servings = row["servings"].get<double>();
+                    valid = true;
+                }
+            }
+            else
+            {
+                splitCsvLine(line, fields);
+                if (fields.size() == 3)
+                {
+                    dateText = fields[0];
+                    foodName = fields[1];
+                    char *end = nullptr;
+                    servings = strtod(fields[2].c_str(), &end);
+                    valid = end != fields[2].c_str() && *end == '\0';
+                }
+                // Skip a header row naming the columns
+                if (lineNumber == 1 && !valid && fields[0].size() == 4 && containsIgnoreCase(fields[0], "date"))
+                    continue;
+            }
+
+            Date date;
+            if (!valid || !Date::parse(dateText, date) || !(servings > 0.0) || !isfinite(servings))
+            {
+                if (malformedLines.size() < 10)
+                    malformedLines.push_back(lineNumber);
+                malformedCount++;
+                continue;
+            }
+
+            chunk.push_back(DiaryColumnStore::NewEntry{date, 0, servings, 0.0});
+            chunkFoods.push_back(move(foodName));
+            if (chunk.size() == importChunkRows)
+                flush();
+        }
+        flush();
+
+        if (importedCount > 0)
+        {
+            daysChanged(vector<Date>(touched.begin(), touched.end()));
+            uint32_t batch = nextImportBatch++;
+            importBatches[batch] = move(imported);
+            DiaryCommand command{DiaryCommand::Kind::IMPORT, *touched.begin(), EntryId(), batch,
+                                 static_cast<double>(importedCount), importedCalories};
+            recordCommand(command);
+        }
+
+        cout << "Imported " << importedCount << " entries across " << touched.size() << " days." << endl;
+        if (malformedCount > 0)
+        {
+            cout << "Skipped " << malformedCount << " malformed rows (lines";
+            for (size_t number : malformedLines)
+                cout << " " << number;
+            cout << (malformedCount > malformedLines.size() ? " ...)" : ")") << endl;
+        }
+        if (!unknownFoods.empty())
+        {
+            cout << "Skipped rows with " << unknownFoods.size() << " unknown foods:" << endl;
+            for (const auto &[name, rows] : unknownFoods)
+            {
+                cout << "  " << name << " (" << rows << " rows)" << endl;
+            }
+        }
+        return importedCount > 0;
+    }
+
+    void importEntriesFromFile()
+    {
+        cout << "Enter path of CSV (date,food,servings) or JSONL file: ";
+        string path;
+        getline(cin >> ws, path);
+        importEntries(path);
+    }
+
+    // Pages through a lazy search range and lets the user pick one food.
+    // Only the page on screen is ever evaluated.
+    template <typename Range>
+    FoodHandle selectFoodFromPages(const Range &range)
+    {
+        const size_t pageSize = 20;
+        size_t offset = 0;
+
+        while (true)
+        {
+            vector<FoodHandle> page;
+            page.reserve(pageSize + 1);
+            // Fetch one extra result to know whether a next page exists
+            for (FoodHandle food : range.page(offset, pageSize + 1))
+            {
+                page.push_back(food);
+            }
+
+            bool hasNext = page.size() > pageSize;
+            if (hasNext)
+            {
+                page.pop_back();
+            }
+
+            if (page.empty())
+            {
+                cout << "No foods available for selection." << endl;
+                return FoodHandle();
+            }
+
+            for (size_t i = 0; i < page.size(); i++)
+            {
+                cout << (offset + i + 1) << ". " << page[i]->getName() << " (" << page[i]->getType()
+                     << ") - " << page[i]->getCalories() << " calories\n";
+            }
+
+            cout << "\nSelect food number (" << offset + 1 << "-" << offset + page.size() << ")";
+            if (hasNext)
+                cout << ", 'n' for next page";
+            if (offset > 0)
+                cout << ", 'p' for previous page";
+            cout << ": ";
+
+            string input;
+            cin >> input;
+
+            if (input == "n" && hasNext)
+            {
+                offset += pageSize;
+                continue;
+            }
+            if (input == "p" && offset > 0)
+            {
+                offset -= pageSize;
+                continue;
+            }
+
+            size_t foodIndex = 0;
+            try
+            {
+                foodIndex = stoul(input);
+            }
+            catch (const exception &)
+            {
+                foodIndex = 0;
+            }
+
+            if (foodIndex <= offset || foodIndex > offset + page.size())
+            {
+                cout << "Invalid food selection." << endl;
+                return FoodHandle();
+            }
+            return page[foodIndex - offset - 1];
+        }
+    }
+
+    // User interface methods
+    void addFoodToLog()
+    {
+        // First, let the user choose how to select a food
+        cout << "\nSelect food by:\n";
+        cout << "1. Browse all foods\n";
+        cout << "2. Search by keywords\n";
+        cout << "Choice: ";
+
+        int choice;
+        cin >> choice;
+        cin.ignore();
+
+        FoodHandle selectedFood;
+
+        if (choice == 1)
+        {
+            cout << "\n=== All Foods in Database (" << dbManager.foods.size() << ") ===" << endl;
+            selectedFood = selectFoodFromPages(dbManager.queryFoods({}, false));
+        }
+        else if (choice == 2)
+        {
+            cout << "Enter keywords (separated by spaces): ";
+            string keywordInput;
+            getline(cin, keywordInput);
+
+            // Split input into keywords
+            vector<string> keywords;
+            stringstream ss(keywordInput);
+            string keyword;
+            while (ss >> keyword)
+            {
+                keywords.push_back(keyword);
+            }
+
+            if (keywords.empty())
+            {
+                cout << "No keywords provided." << endl;
+                return;
+            }
+
+            cout << "Match: 1. All keywords or 2. Any keyword? ";
+            int matchChoice;
+            cin >> matchChoice;
+            cin.ignore();
+
+            bool matchAll = (matchChoice == 1);
+            auto results = dbManager.queryFoods(keywords, matchAll);
+            if (results.empty())
+            {
+                cout << "No foods match the given keywords." << endl;
+                return;
+            }
+
+            cout << "\nMatching Foods:\n";
+            selectedFood = selectFoodFromPages(results);
+        }
+        else
+        {
+            cout << "Invalid choice." << endl;
+            return;
+        }
+
+        if (!selectedFood)
+        {
+            return;
+        }
+
+        // Ask for number of servings
+        cout << "Enter number of servings: ";
+        double servings;
+        cin >> servings;
+        cin.ignore();
+
+        if (servings <= 0)
+        {
+            cout << "Invalid number of servings." << endl;
+            return;
+        }
+
+        // Add the food to the log
+        addFood(currentDate, selectedFood->getName(), servings);
+    }
+
+    void deleteFoodFromLog()
+    {
+        displayDailyLog(currentDate);
+
+        size_t entryCount = dailyLogs.liveCount(currentDate);
+        if (entryCount == 0)
+        {
+            cout << "No entries to delete." << endl;
+            return;
+        }
+
+        cout << "Enter entry number to delete: ";
+        int index;
+        cin >> index;
+        cin.ignore();
+
+        if (index < 1 || index > static_cast<int>(entryCount))
+        {
+            cout << "Invalid entry number." << endl;
+            return;
+        }
+
+        deleteFood(currentDate, index - 1);
+    }
+
+    void changeDate()
+    {
+        cout << "Enter date (YYYY-MM-DD): ";
+        string date;
+        cin >> date;
+        cin.ignore();
+
+        setCurrentDate(date);
+    }
+
+    void showUndoStack() const
+    {
+        if (history.undoSize() == 0 && history.redoSize() == 0)
+        {
+            cout << "Undo stack is empty." << endl;
+            return;
+        }
+
+        cout << "\nUndo Stack (latest first, " << history.undoSize() << " of at most "
+             << history.capacity() << "):\n";
+        for (size_t i = 0; i < history.undoSize(); i++)
+        {
+            cout << (i + 1) << ". " << history.undoAt(i).getDescription(dailyLogs) << endl;
+        }
+
+        if (history.redoSize() > 0)
+        {
+            cout << "\nRedo Stack (next first):\n";
+            for (size_t i = 0; i < history.redoSize(); i++)
+            {
+                cout << (i + 1) << ". " << history.redoAt(i).getDescription(dailyLogs) << endl;
+            }
+        }
+
+        cout << endl;
+    }
+
+    // Total, maximum and logged-day count between two dates (inclusive) in O(log n)
+    CalorieRangeSummary getCalorieSummaryForRange(Date fromDate, Date toDate) const
+    {
+        return calorieTree.query(fromDate, toDate);
+    }
+
+    void displayIntakeReport(const string &title, Date fromDate, Date toDate)
+    {
+        CalorieRangeSummary summary = getCalorieSummaryForRange(fromDate, toDate);
+        int spanDays = toDate - fromDate + 1;
+
+        cout << "\n===== " << title << " Intake Report: " << fromDate << " to " << toDate << " =====" << endl;
+        cout << "Days logged: " << summary.loggedDays << " of " << spanDays << endl;
+        cout << "Total calories: " << summary.total << endl;
+        cout << "Average per logged day: " << summary.averagePerLoggedDay() << endl;
+        cout << "Average per calendar day: " << (spanDays > 0 ? summary.total / spanDays : 0.0) << endl;
+        if (summary.loggedDays)
+        {
+            cout << "Highest day: " << summary.max << " calories on " << summary.maxDay << endl;
+
+            // Top contributors, from one scan over the food id and calorie columns
+            ensureRangeLoaded(fromDate, toDate);
+            vector<double> byFood = dailyLogs.caloriesByFood(fromDate, toDate);
+            vector<uint32_t> order(byFood.size());
+            for (uint32_t id = 0; id < order.size(); id++)
+                order[id] = id;
+            size_t shown = min<size_t>(5, order.size());
+            partial_sort(order.begin(), order.begin() + shown, order.end(), [&byFood](uint32_t a, uint32_t b)
+                         { return byFood[a] > byFood[b]; });
+            cout << "Top foods:" << endl;
+            for (size_t i = 0; i < shown && byFood[order[i]] > 0; i++)
+            {
+                cout << "  " << dailyLogs.foodName(order[i]) << ": " << byFood[order[i]] << " calories" << endl;
+            }
+        }
+        cout << "==============================" << endl;
+    }
+
+    void showIntakeReports()
+    {
+        cout << "\nIntake report for:\n";
+        cout << "1. Week ending " << currentDate << "\n";
+        cout << "2. Month of " << currentDate << "\n";
+        cout << "3. Year of " << currentDate << "\n";
+        cout << "4. Custom range\n";
+        cout << "Choice: ";
+
+        int choice;
+        cin >> choice;
+        cin.ignore();
+
+        switch (choice)
+        {
+        case 1:
+            displayIntakeReport("Weekly", currentDate - 6, currentDate);
+            break;
+        case 2:
+            displayIntakeReport("Monthly", currentDate.firstOfMonth(), currentDate.lastOfMonth());
+            break;
+        case 3:
+            displayIntakeReport("Yearly", currentDate.firstOfYear(), currentDate.lastOfYear());
+            break;
+        case 4:
+        {
+            string fromInput, toInput;
+            cout << "Enter start date (YYYY-MM-DD): ";
+            cin >> fromInput;
+            cout << "Enter end date (YYYY-MM-DD): ";
+            cin >> toInput;
+            cin.ignore();
+
+            Date fromDate, toDate;
+            if (!Date::parse(fromInput, fromDate) || !Date::parse(toInput, toDate))
+            {
+                cout << "Invalid date. Please use YYYY-MM-DD with a year from " << Date::MIN_YEAR << " to "
+                     << Date::MAX_YEAR << "." << endl;
+                return;
+            }
+            if (fromDate > toDate)
+            {
+                cout << "Start date must not be after end date." << endl;
+                return;
+            }
+            displayIntakeReport("Custom", fromDate, toDate);
+            break;
+        }
+        default:
+            cout << "Invalid choice." << endl;
+        }
+    }
+
+    double getTotalCaloriesForDate(Date date) const
+    {
+        return calorieTree.query(date, date).total;
+    }
+
+    // Group commit for bulk callers. While it is on, changed days are only noted;
+    // commitJournal() then records their current state as one journal record with
+    // one sync, however many changes each day saw. Changes since the last commit
+    // are not durable yet.
+    void setGroupCommit(bool on)
+    {
+        if (!on)
+        {
+            commitJournal();
+        }
+        groupCommit = on;
+    }
+
+    void commitJournal()
+    {
+        if (pendingJournalDays.empty())
+            return;
+        vector<Date> days(pendingJournalDays.begin(), pendingJournalDays.end());
+        pendingJournalDays.clear();
+        writeJournalRecord(days);
+    }
+
+    // Reports the earliest day whose total changed since the previous call, for
+    // consumers that cache per-day results
+    bool takeEarliestChange(Date &date)
+    {
+        if (!totalsChanged)
+        {
+            return false;
+        }
+        date = totalsChangedFrom;
+        totalsChanged = false;
+        return true;
+    }
+};
+
+// Class to store user's daily profile information
+class DailyProfile
+{
+private:
+    double weight; // in kg
+    ActivityLevel activityLevel;
+    double bodyFat; // percent of body weight
+
+public:
+    // Assumed until a measurement is entered; only the lean-mass formulas use it
+    static constexpr double DEFAULT_BODY_FAT = 20.0;
+
+    DailyProfile(double w = 70.0, ActivityLevel a = ActivityLevel::MODERATELY_ACTIVE,
+                 double bf = DEFAULT_BODY_FAT)
+        : weight(w), activityLevel(a), bodyFat(bf) {}
+
+    double getWeight() const { return weight; }
+    void setWeight(double w) { weight = w; }
+
+    ActivityLevel getActivityLevel() const { return activityLevel; }
+    void setActivityLevel(ActivityLevel a) { activityLevel = a; }
+
+    double getBodyFat() const { return bodyFat; }
+    void setBodyFat(double bf) { bodyFat = bf; }
+
+    bool operator==(const DailyProfile &other) const
+    {
+        return weight == other.weight && activityLevel == other.activityLevel && bodyFat == other.bodyFat;
+    }
+    bool operator!=(const DailyProfile &other) const { return !(*this == other); }
+
+    json toJson() const
+    {
+        json j;
+        j["weight"] = weight;
+        j["activityLevel"] = static_cast<int>(activityLevel);
+        j["bodyFat"] = bodyFat;
+        return j;
+    }
+
+    static DailyProfile fromJson(const json &j)
+    {
+        return DailyProfile(
+            j["weight"].get<double>(),
+            static_cast<ActivityLevel>(j["activityLevel"].get<int>()),
+            j.value("bodyFat", DEFAULT_BODY_FAT));
+    }
+};
+
+// BMR equations as policies, one struct per calculation method. Inputs are per
+// row: weight in kg, height in cm, age in years, male as 1.0 or 0.0 and body fat
+// in percent. Each bmr() is branch-free so loops instantiated on it vectorize.
+struct HarrisBenedictFormula
+{
+    static constexpr const char *name = "Harris-Benedict";
+    static constexpr bool usesBodyFat = false;
+
+    static double bmr(double w, double h, double a, double male, double)
+    {
+        return male * (66.5 + 13.75 * w + 5.003 * h - 6.75 * a) +
+               (1.0 - male) * (655.1 + 9.563 * w + 1.850 * h - 4.676 * a);
+    }
+};
+
+// Roza and Shizgal's 1984 refit of the Harris-Benedict equations
+struct RevisedHarrisBenedictFormula
+{
+    static constexpr const char *name = "Revised Harris-Benedict";
+    static constexpr bool usesBodyFat = false;
+
+    static double bmr(double w, double h, double a, double male, double)
+    {
+        return male * (88.362 + 13.397 * w + 4.799 * h - 5.677 * a) +
+               (1.0 - male) * (447.593 + 9.247 * w + 3.098 * h - 4.330 * a);
+    }
+};
+
+struct MifflinStJeorFormula
+{
+    static constexpr const char *name = "Mifflin-St Jeor";
+    static constexpr bool usesBodyFat = false;
+
+    static double bmr(double w, double h, double a, double male, double)
+    {
+        return 10.0 * w + 6.25 * h - 5.0 * a + male * 5.0 + (1.0 - male) * -161.0;
+    }
+};
+
+// Lean-mass formulas: only weight and body fat matter
+struct KatchMcArdleFormula
+{
+    static constexpr const char *name = "Katch-McArdle";
+    static constexpr bool usesBodyFat = true;
+
+    static double bmr(double w, double, double, double, double bodyFat)
+    {
+        return 370.0 + 21.6 * w * (1.0 - bodyFat * 0.01);
+    }
+};
+
+struct CunninghamFormula
+{
+    static constexpr const char *name = "Cunningham";
+    static constexpr bool usesBodyFat = true;
+
+    static double bmr(double w, double, double, double, double bodyFat)
+    {
+        return 500.0 + 22.0 * w * (1.0 - bodyFat * 0.01);
+    }
+};
+
+// Calls fn with the policy for a method. This is the only place a method value is
+// switched on; unknown values get Mifflin-St Jeor, the default method.
+template <typename Fn>
+auto withBmrFormula(CalorieCalculationMethod method, Fn &&fn)
+{
+    switch (method)
+    {
+    case CalorieCalculationMethod::HARRIS_BENEDICT:
+        return fn(HarrisBenedictFormula());
+    case CalorieCalculationMethod::KATCH_MCARDLE:
+        return fn(KatchMcArdleFormula());
+    case CalorieCalculationMethod::CUNNINGHAM:
+        return fn(CunninghamFormula());
+    case CalorieCalculationMethod::HARRIS_BENEDICT_REVISED:
+        return fn(RevisedHarrisBenedictFormula());
+    case CalorieCalculationMethod::MIFFLIN_ST_JEOR:
+    default:
+        return fn(MifflinStJeorFormula());
+    }
+}
+
+// Batch BMR and calorie-target computation over structure-of-arrays inputs. Each
+// row holds the profile inputs of one date; UserProfile::calculateDailyCalorieTargets
+// fills a row per day of a range. Rows are grouped by method and each group
+// runs through the kernel instantiated for its formula, so the inner loops never
+// dispatch per element.
+struct CalorieTargetBatch
+{
+    // Inputs, one entry per row
+    vector<double> weight;  // kg
+    vector<double> height;  // cm
+    vector<double> age;     // years
+    vector<double> bodyFat; // percent
+    vector<uint8_t> gender;
+    vector<uint8_t> method;
+    vector<uint8_t> activity;
+
+    // Outputs of compute()
+    vector<double> bmr;
+    vector<double> target;
+
+    // Unknown levels count as moderately active
+    static double activityMultiplier(ActivityLevel level)
+    {
+        static const double table[6] = {1.2, 1.375, 1.55, 1.725, 1.9, 1.55};
+        return table[min<unsigned>(static_cast<unsigned>(level), 5)];
+    }
+
+    size_t size() const { return weight.size(); }
+
+    void reserve(size_t rows)
+    {
+        weight.reserve(rows);
+        height.reserve(rows);
+        age.reserve(rows);
+        bodyFat.reserve(rows);
+        gender.reserve(rows);
+        method.reserve(rows);
+        activity.reserve(rows);
+    }
+
+    void add(double w, double h, double a, double bf, Gender g, CalorieCalculationMethod m, ActivityLevel level)
+    {
+        weight.push_back(w);
+        height.push_back(h);
+        age.push_back(a);
+        bodyFat.push_back(bf);
+        gender.push_back(static_cast<uint8_t>(g));
+        method.push_back(static_cast<uint8_t>(m));
+        activity.push_back(static_cast<uint8_t>(level));
+    }
+
+    void compute()
+    {
+        size_t n = size();
+        bmr.resize(n);
+        target.resize(n);
+
+        // Counting sort of the rows by method
+        size_t groupStart[257] = {};
+        for (size_t i = 0; i < n; i++)
+            groupStart[method[i] + 1]++;
+        for (size_t m = 0; m < 256; m++)
+            groupStart[m + 1] += groupStart[m];
+        vector<uint32_t> order(n);
+        size_t fill[256];
+        copy(groupStart, groupStart + 256, fill);
+        for (size_t i = 0; i < n; i++)
+            order[fill[method[i]]++] = static_cast<uint32_t>(i);
+
+        // Gather into grouped columns
+        vector<double> w(n), h(n), a(n), male(n), bf(n), factor(n), outBmr(n), outTarget(n);
+        for (size_t k = 0; k < n; k++)
+        {
+            uint32_t i = order[k];
+            w[k] = weight[i];
+            h[k] = height[i];
+            a[k] = age[i];
+            male[k] = gender[i] == static_cast<uint8_t>(Gender::MALE) ? 1.0 : 0.0;
+            bf[k] = bodyFat[i];
+            factor[k] = activityMultiplier(static_cast<ActivityLevel>(activity[i]));
+        }
+
+        // One kernel call per method present
+        for (size_t m = 0; m < 256; m++)
+        {
+            size_t begin = groupStart[m], count = groupStart[m + 1] - begin;
+            if (count == 0)
+                continue;
+            withBmrFormula(static_cast<CalorieCalculationMethod>(m), [&](auto formula)
+                           {
+                               kernel<decltype(formula)>(count, w.data() + begin, h.data() + begin,
+                                                         a.data() + begin, male.data() + begin,
+                                                         bf.data() + begin, factor.data() + begin,
+                                                         outBmr.data() + begin, outTarget.data() + begin);
+                           });
+        }
+
+        // Scatter back to row order
+        for (size_t k = 0; k < n; k++)
+        {
+            bmr[order[k]] = outBmr[k];
+            target[order[k]] = outTarget[k];
+        }
+    }
+
+    template <typename Formula>
+    static void kernel(size_t n, const double *__restrict w, const double *__restrict h,
+                       const double *__restrict a, const double *__restrict male,
+                       const double *__restrict bf, const double *__restrict factor,
+                       double *__restrict outBmr, double *__restrict outTarget)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            double rowBmr = Formula::bmr(w[i], h[i], a[i], male[i], bf[i]);
+            outBmr[i] = rowBmr;
+            outTarget[i] = rowBmr * factor[i];
+        }
+    }
+};
+
+// Class to represent user's unchanging profile information
+class UserProfile
+{
+private:
+    string userId;
+    Gender gender;
+    double height; // in cm
+    int age;
+    CalorieCalculationMethod calculationMethod;
+
+    // Earliest date whose target or weight changed since takeEarliestChange()
+    bool changed = false;
+    Date changedFrom;
+
+    void noteChange(Date date)
+    {
+        if (!changed || date < changedFrom)
+        {
+            changedFrom = date;
+        }
+        changed = true;
+    }
+
+    // Gender, height, age and method affect every date
+    void noteChangeEverywhere()
+    {
+        noteChange(Date(numeric_limits<int32_t>::min()));
+    }
+
+    // Step function over dates: each profile applies from its date until the next
+    // one. Only dates where something changed are stored.
+    map<Date, DailyProfile> dailyProfiles;
+
+    // Drops change points that repeat the recorded profile before them. The
+    // first point is always kept, even when it matches the default placeholder,
+    // since it marks when the user started recording.
+    void removeRedundantProfiles()
+    {
+        const DailyProfile *previous = nullptr;
+        for (auto it = dailyProfiles.begin(); it != dailyProfiles.end();)
+        {
+            if (previous && it->second == *previous)
+            {
+                it = dailyProfiles.erase(it);
+                continue;
+            }
+            previous = &it->second;
+            ++it;
+        }
+    }
+
+    // In effect before the first recorded profile
+    static const DailyProfile &defaultDailyProfile()
+    {
+        static const DailyProfile defaultProfile;
+        return defaultProfile;
+    }
+
+public:
+    UserProfile(
+        string id = "user",
+        Gender g = Gender::OTHER,
+        double h = 170.0,
+        int a = 30,
+        CalorieCalculationMethod m = CalorieCalculationMethod::MIFFLIN_ST_JEOR) : userId(id), gender(g), height(h), age(a), calculationMethod(m) {}
+
+    // Getters and setters
+    string getUserId() const { return userId; }
+
+    Gender getGender() const { return gender; }
+    void setGender(Gender g)
+    {
+        gender = g;
+        noteChangeEverywhere();
+    }
+
+    double getHeight() const { return height; }
+    void setHeight(double h)
+    {
+        height = h;
+        noteChangeEverywhere();
+    }
+
+    int getAge() const { return age; }
+    void setAge(int a)
+    {
+        age = a;
+        noteChangeEverywhere();
+    }
+
+    CalorieCalculationMethod getCalculationMethod() const { return calculationMethod; }
+    void setCalculationMethod(CalorieCalculationMethod m)
+    {
+        calculationMethod = m;
+        noteChangeEverywhere();
+    }
+
+    // Reports the earliest date affected by changes since the previous call
+    bool takeEarliestChange(Date &date)
+    {
+        if (!changed)
+        {
+            return false;
+        }
+        date = changedFrom;
+        changed = false;
+        return true;
+    }
+
+    // Calculate daily calorie target
+    double calculateDailyCalorieTarget(Date date) const
+    {
+        const DailyProfile &profile = getEffectiveProfile(date);
+        double male = gender == Gender::MALE ? 1.0 : 0.0;
+        double bmr = withBmrFormula(calculationMethod, [&](auto formula)
+                                    { return formula.bmr(profile.getWeight(), height, age, male, profile.getBodyFat()); });
+
+        // Apply activity multiplier
+        return bmr * CalorieTargetBatch::activityMultiplier(profile.getActivityLevel());
+    }
+
+    // Targets for every date in [from, to], in date order. The profile changes are
+    // walked once alongside the dates to fill the batch, then the kernel runs.
+    vector<double> calculateDailyCalorieTargets(Date fromDate, Date toDate) const
+    {
+        if (toDate < fromDate)
+            return {};
+
+        CalorieTargetBatch batch;
+        batch.reserve(toDate - fromDate + 1);
+        auto nextChange = dailyProfiles.upper_bound(fromDate);
+        const DailyProfile *profile = &getEffectiveProfile(fromDate);
+        for (Date date = fromDate; date <= toDate; date = date + 1)
+        {
+            for (; nextChange != dailyProfiles.end() && nextChange->first <= date; ++nextChange)
+                profile = &nextChange->second;
+            batch.add(profile->getWeight(), height, age, profile->getBodyFat(), gender, calculationMethod,
+                      profile->getActivityLevel());
+        }
+        batch.compute();
+        return move(batch.target);
+    }
+
+    // Date the user first entered a profile; false while only the default
+    // placeholder applies. The first change point is never collapsed, so this
+    // holds even when that entry matches the default.
+    bool firstRecordedDate(Date &date) const
+    {
+        if (dailyProfiles.empty())
+        {
+            return false;
+        }
+        date = dailyProfiles.begin()->first;
+        return true;
+    }
+
+    // Check if a profile change was recorded on a specific date
+    bool hasProfileForDate(Date date) const
+    {
+        return dailyProfiles.find(date) != dailyProfiles.end();
+    }
+
+    // Set the profile from a date onwards, until the next recorded change
+    void setDailyProfile(Date date, const DailyProfile &profile)
+    {
+        noteChange(date);
+        auto it = dailyProfiles.insert_or_assign(date, profile).first;
+        auto after = next(it);
+        if (after != dailyProfiles.end() && after->second == profile)
+        {
+            dailyProfiles.erase(after);
+        }
+        // Only a real earlier change point makes this one redundant, never the default
+        if (it != dailyProfiles.begin() && prev(it)->second == profile)
+        {
+            dailyProfiles.erase(it);
+        }
+    }
+
+    // Profile in effect on a date: the latest one recorded on or before it, found
+    // by binary search. Never modifies the profile.
+    const DailyProfile &getEffectiveProfile(Date date) const
+    {
+        auto it = dailyProfiles.upper_bound(date);
+        if (it == dailyProfiles.begin())
+        {
+            return defaultDailyProfile();
+        }
+        return prev(it)->second;
+    }
+
+    DailyProfile getDailyProfile(Date date) const
+    {
+        return getEffectiveProfile(date);
+    }
+
+    // Save profile to JSON
+    json toJson() const
+    {
+        json j;
+        j["userId"] = userId;
+        j["gender"] = static_cast<int>(gender);
+        j["height"] = height;
+        j["age"] = age;
+        j["calculationMethod"] = static_cast<int>(calculationMethod);
+
+        json dailyProfilesJson;
+        for (const auto &[date, profile] : dailyProfiles)
+        {
+            dailyProfilesJson[date.toString()] = profile.toJson();
+        }
+        j["dailyProfiles"] = dailyProfilesJson;
+
+        return j;
+    }
+
+    // Load profile from JSON
+    static UserProfile fromJson(const json &j)
+    {
+        CalorieCalculationMethod method = CalorieCalculationMethod::MIFFLIN_ST_JEOR;
+        if (!parseCalculationMethod(j["calculationMethod"].get<int>(), method))
+        {
+            cout << "Unknown calculation method " << j["calculationMethod"]
+                 << ", using " << MifflinStJeorFormula::name << endl;
+        }
+        UserProfile profile(
+            j["userId"].get<string>(),
+            static_cast<Gender>(j["gender"].get<int>()),
+            j["height"].get<double>(),
+            j["age"].get<int>(),
+            method);
+
+        if (j.contains("dailyProfiles"))
+        {
+            for (const auto &[dateKey, profileJson] : j["dailyProfiles"].items())
+            {
+                Date date;
+                if (!Date::parse(dateKey, date))
+                {
+                    cout << "Skipping daily profile with invalid date: " << dateKey << endl;
+                    continue;
+                }
+                profile.dailyProfiles[date] = DailyProfile::fromJson(profileJson);
+                Instrumentation::count(Instrumentation::PROFILE_DAYS_PARSED, 1);
+            }
+            // Older files hold a copy for every date ever queried
+            profile.removeRedundantProfiles();
+        }
+
+        return profile;
+    }
+};
+
+// Rolling statistics over a daily series that may have gaps (days with nothing
+// logged). push() takes the next day in O(1): per window it keeps running sums
+// over the current and the preceding window, fed from a ring of the last 180
+// days, and each exponential average updates in place.
+class RollingSeries
+{
+public:
+    static constexpr int WINDOW_COUNT = 3;
+    static constexpr int WINDOWS[WINDOW_COUNT] = {7, 30, 90};
+
+private:
+    static constexpr int RING_DAYS = 2 * 90;
+
+    double values[RING_DAYS] = {};
+    bool present[RING_DAYS] = {};
+    size_t days = 0;
+
+    // Per window: sum and count over the last W days, and over the W days before
+    double currentSum[WINDOW_COUNT] = {};
+    int currentCount[WINDOW_COUNT] = {};
+    double previousSum[WINDOW_COUNT] = {};
+    int previousCount[WINDOW_COUNT] = {};
+    double smoothed[WINDOW_COUNT] = {};
+    bool hasValue = false;
+    double latest = 0.0;
+
+    // Running sums drift as values come and go; recompute them from the ring once
+    // per lap so the error stays bounded
+    void resync()
+    {
+        for (int w = 0; w < WINDOW_COUNT; w++)
+        {
+            currentSum[w] = previousSum[w] = 0.0;
+            currentCount[w] = previousCount[w] = 0;
+            for (int back = 0; back < 2 * WINDOWS[w] && back < static_cast<int>(days); back++)
+            {
+                size_t slot = (days - 1 - back) % RING_DAYS;
+                if (!present[slot])
+                    continue;
+                if (back < WINDOWS[w])
+                {
+                    currentSum[w] += values[slot];
+                    currentCount[w]++;
+                }
+                else
+                {
+                    previousSum[w] += values[slot];
+                    previousCount[w]++;
+                }
+            }
+        }
+    }
+
+public:
+    // Appends the next day; a day without a value still moves the windows on
+    void push(double value, bool isPresent)
+    {
+        for (int w = 0; w < WINDOW_COUNT; w++)
+        {
+            size_t width = WINDOWS[w];
+            // The day leaving the current window joins the preceding one...
+            if (days >= width)
+            {
+                size_t slot = (days - width) % RING_DAYS;
+                if (present[slot])
+                {
+                    currentSum[w] -= values[slot];
+                    currentCount[w]--;
+                    previousSum[w] += values[slot];
+                    previousCount[w]++;
+                }
+            }
+            // ...and the one leaving that drops out
+            if (days >= 2 * width)
+            {
+                size_t slot = (days - 2 * width) % RING_DAYS;
+                if (present[slot])
+                {
+                    previousSum[w] -= values[slot];
+                    previousCount[w]--;
+                }
+            }
+            if (isPresent)
+            {
+                currentSum[w] += value;
+                currentCount[w]++;
+                double alpha = 2.0 / (width + 1);
+                smoothed[w] = hasValue ? smoothed[w] + alpha * (value - smoothed[w]) : value;
+            }
+        }
+
+        size_t slot = days % RING_DAYS;
+        values[slot] = value;
+        present[slot] = isPresent;
+        days++;
+        if (isPresent)
+        {
+            hasValue = true;
+            latest = value;
+        }
+        if (days % RING_DAYS == 0)
+        {
+            resync();
+        }
+    }
+
+    bool empty() const { return !hasValue; }
+    double latestValue() const { return latest; }
+
+    // Statistics for window index w; each is NaN when there is nothing to report
+    double average(int w) const
+    {
+        return currentCount[w] ? currentSum[w] / currentCount[w] : NAN;
+    }
+    // Average over the window minus the average over the window before it
+    double delta(int w) const
+    {
+        return currentCount[w] && previousCount[w]
+                   ? currentSum[w] / currentCount[w] - previousSum[w] / previousCount[w]
+                   : NAN;
+    }
+    // Exponential average with span W (alpha = 2 / (W + 1))
+    double trend(int w) const
+    {
+        return hasValue ? smoothed[w] : NAN;
+    }
+    int valueCount(int w) const { return currentCount[w]; }
+};
+
+// Trends as of one date: weight every day from the first recorded profile on,
+// intake and intake minus target on logged days only
+struct TrendReport
+{
+    Date date;
+    RollingSeries weight;
+    RollingSeries intake;
+    RollingSeries balance;
+};
+
+// Keeps one user's trend series up to date. Finished days (before the report
+// date) are pushed once each, so a daily report costs O(1) plus the days since
+// the last one; the report date itself is added to a copy, because entries for
+// it may still change. Edits to days already pushed restart the series from
+// HISTORY_DAYS before the report date.
+class TrendTracker
+{
+private:
+    RollingSeries weight;
+    RollingSeries intake;
+    RollingSeries balance;
+    Date nextDate; // first day not yet pushed
+    bool started = false;
+
+    // Days before weighedFrom only have the default weight, so they count as absent
+    static void pushDay(RollingSeries &weightSeries, RollingSeries &intakeSeries, RollingSeries &balanceSeries,
+                        const UserProfile &profile, const FoodDiary &diary, Date date, double target,
+                        optional<Date> weighedFrom)
+    {
+        CalorieRangeSummary day = diary.getCalorieSummaryForRange(date, date);
+        bool logged = day.loggedDays > 0;
+        bool weighed = weighedFrom && *weighedFrom <= date;
+        weightSeries.push(profile.getEffectiveProfile(date).getWeight(), weighed);
+        intakeSeries.push(day.total, logged);
+        balanceSeries.push(day.total - target, logged);
+    }
+
+public:
+    // Long enough for the 90-day exponential average to forget its start
+    static const int HISTORY_DAYS = 365;
+
+    TrendReport report(Date date, UserProfile &profile, FoodDiary &diary)
+    {
+        Date profileChange, diaryChange;
+        bool restart = !started || date < nextDate;
+        if (profile.takeEarliestChange(profileChange) && profileChange < nextDate)
+            restart = true;
+        if (diary.takeEarliestChange(diaryChange) && diaryChange < nextDate)
+            restart = true;
+        if (restart)
+        {
+            weight = intake = balance = RollingSeries();
+            nextDate = date - HISTORY_DAYS;
+            started = true;
+        }
+
+        vector<double> targets = profile.calculateDailyCalorieTargets(nextDate, date);
+        optional<Date> weighedFrom;
+        Date firstRecorded;
+        if (profile.firstRecordedDate(firstRecorded))
+            weighedFrom = firstRecorded;
+        int i = 0;
+        for (; nextDate < date; nextDate = nextDate + 1)
+        {
+            pushDay(weight, intake, balance, profile, diary, nextDate, targets[i++], weighedFrom);
+        }
+
+        TrendReport result{date, weight, intake, balance};
+        pushDay(result.weight, result.intake, result.balance, profile, diary, date, targets[i], weighedFrom);
+        return result;
+    }
+};
+
+// Projects weight forward with an energy-balance model. Each day the gap between
+// intake and expenditure changes body mass at 7700 calories per kg, and
+// expenditure (the user's BMR formula times the activity factor) is evaluated
+// again at the new weight, so a deficit shrinks as weight falls. Age advances
+// with the days; activity level and body fat percentage stay as they are on the
+// start date.
+class WeightForecaster
+{
+public:
+    static constexpr double CALORIES_PER_KG = 7700.0;
+    static const int HISTORY_DAYS = 90;
+    static const int MIN_SAMPLES = 7; // logged days needed for the Monte Carlo mode
+
+    // Starting state plus the logged daily intakes it samples from
+    struct Model
+    {
+        Date start;
+        double weight;
+        double height;
+        double age;
+        double male;
+        double bodyFat;
+        double activityFactor;
+        CalorieCalculationMethod method;
+        vector<double> intakeHistory; // logged days of the HISTORY_DAYS before start
+        double meanIntake;            // their mean, or the start-day target without any
+    };
+
+    struct Projection
+    {
+        vector<double> weights; // weights[d] at the end of day d after the start
+        int goalDay = -1;       // first day at or past the goal, -1 if not reached
+    };
+
+    struct MonteCarloResult
+    {
+        int runs = 0;
+        vector<double> finalWeights; // sorted
+        vector<int> goalDays;        // sorted, runs that reached the goal only
+
+        static double percentile(const vector<double> &sorted, double q)
+        {
+            return sorted[min(sorted.size() - 1, static_cast<size_t>(q * sorted.size()))];
+        }
+        static int percentile(const vector<int> &sorted, double q)
+        {
+            return sorted[min(sorted.size() - 1, static_cast<size_t>(q * sorted.size()))];
+        }
+    };
+
+    // The state on start, with intake from the HISTORY_DAYS before it; the start
+    // day itself is usually still being logged, so it would bias the mean low
+    static Model modelFor(const UserProfile &profile, const FoodDiary &diary, Date start)
+    {
+        const DailyProfile &daily = profile.getEffectiveProfile(start);
+        Model model;
+        model.start = start;
+        model.weight = daily.getWeight();
+        model.height = profile.getHeight();
+        model.age = profile.getAge();
+        model.male = profile.getGender() == Gender::MALE ? 1.0 : 0.0;
+        model.bodyFat = daily.getBodyFat();
+        model.activityFactor = CalorieTargetBatch::activityMultiplier(daily.getActivityLevel());
+        model.method = profile.getCalculationMethod();
+
+        double total = 0.0;
+        for (Date date = start - HISTORY_DAYS; date < start; date = date + 1)
+        {
+            CalorieRangeSummary day = diary.getCalorieSummaryForRange(date, date);
+            if (day.loggedDays)
+            {
+                model.intakeHistory.push_back(day.total);
+                total += day.total;
+            }
+        }
+        model.meanIntake = model.intakeHistory.empty() ? profile.calculateDailyCalorieTarget(start)
+                                                       : total / model.intakeHistory.size();
+        return model;
+    }
+
+    // Eating the mean historical intake every day
+    static Projection project(const Model &model, int days, double goal)
+    {
+        Projection projection;
+        projection.weights.reserve(days + 1);
+        withBmrFormula(model.method, [&](auto formula)
+                       {
+                           simulate<decltype(formula)>(model, days, goal, [&]
+                                                       { return model.meanIntake; },
+                                                       projection.goalDay, &projection.weights);
+                       });
+        return projection;
+    }
+
+    // Runs that draw each day's intake from the logged history, split across
+    // threads with independent generators seeded from seed
+    static MonteCarloResult monteCarlo(const Model &model, int days, double goal, int runs,
+                                       unsigned seed = 5489u)
+    {
+        MonteCarloResult result;
+        if (model.intakeHistory.empty() || runs <= 0)
+            return result;
+
+        unsigned threadCount = max(1u, min(thread::hardware_concurrency(), static_cast<unsigned>(runs)));
+        vector<vector<double>> finals(threadCount);
+        vector<vector<int>> goals(threadCount);
+        vector<thread> workers;
+        for (unsigned t = 0; t < threadCount; t++)
+        {
+            int first = static_cast<int>(static_cast<long long>(runs) * t / threadCount);
+            int last = static_cast<int>(static_cast<long long>(runs) * (t + 1) / threadCount);
+            workers.emplace_back([&, t, first, last]
+                                 {
+                                     mt19937_64 rng(seed + t);
+                                     uniform_int_distribution<size_t> pick(0, model.intakeHistory.size() - 1);
+                                     auto sample = [&]
+                                     { return model.intakeHistory[pick(rng)]; };
+                                     withBmrFormula(model.method, [&](auto formula)
+                                                    {
+                                                        for (int run = first; run < last; run++)
+                                                        {
+                                                            int goalDay = -1;
+                                                            finals[t].push_back(simulate<decltype(formula)>(
+                                                                model, days, goal, sample, goalDay, nullptr));
+                                                            if (goalDay >= 0)
+                                                                goals[t].push_back(goalDay);
+                                                        }
+                                                    });
+                                 });
+        }
+        for (thread &worker : workers)
+            worker.join();
+
+        result.runs = runs;
+        for (unsigned t = 0; t < threadCount; t++)
+        {
+            result.finalWeights.insert(result.finalWeights.end(), finals[t].begin(), finals[t].end());
+            result.goalDays.insert(result.goalDays.end(), goals[t].begin(), goals[t].end());
+        }
+        sort(result.finalWeights.begin(), result.finalWeights.end());
+        sort(result.goalDays.begin(), result.goalDays.end());
+        return result;
+    }
+
+private:
+    // One run; the formula is fixed per instantiation, so the daily loop has no
+    // method dispatch
+    template <typename Formula, typename NextIntake>
+    static double simulate(const Model &model, int days, double goal, NextIntake &&nextIntake,
+                           int &goalDay, vector<double> *trajectory)
+    {
+        double weight = model.weight;
+        bool losing = goal < weight;
+        goalDay = weight == goal ? 0 : -1;
+        if (trajectory)
+            trajectory->push_back(weight);
+        for (int day = 1; day <= days; day++)
+        {
+            double age = model.age + day / 365.25;
+            double expenditure = Formula::bmr(weight, model.height, age, model.male, model.bodyFat) *
+                                 model.activityFactor;
+            weight += (nextIntake() - expenditure) / CALORIES_PER_KG;
+            if (trajectory)
+                trajectory->push_back(weight);
+            if (goalDay < 0 && (losing ? weight <= goal : weight >= goal))
+                goalDay = day;
+        }
+        return weight;
+    }
+};
+
+// Class to manage the user's profile and goals
+class ProfileManager
+{
+private:
+    UserProfile userProfile;
+    FoodDiary& foodDiary;
+    string profileFilePath;
+    TrendTracker trends;
+    DirtyTracker dirty;
+
+    string getActivityLevelString(ActivityLevel level) const
+    {
+        switch (level)
+        {
+        case ActivityLevel::SEDENTARY:
+            return "Sedentary";
+        case ActivityLevel::LIGHTLY_ACTIVE:
+            return "Lightly Active";
+        case ActivityLevel::MODERATELY_ACTIVE:
+            return "Moderately Active";
+        case ActivityLevel::VERY_ACTIVE:
+            return "Very Active";
+        case ActivityLevel::EXTREMELY_ACTIVE:
+            return "Extremely Active";
+        default:
+            return "Unknown";
+        }
+    }
+
+    string getGenderString(Gender gender) const
+    {
+        switch (gender)
+        {
+        case Gender::MALE:
+            return "Male";
+        case Gender::FEMALE:
+            return "Female";
+        case Gender::OTHER:
+            return "Other";
+        default:
+            return "Unknown";
+        }
+    }
+
+    string getCalculationMethodString(CalorieCalculationMethod method) const
+    {
+        return withBmrFormula(method, [](auto formula)
+                              { return string(formula.name); });
+    }
+
+    // Lists the methods and reads a choice; false if it is not one of them
+    bool readCalculationMethod(CalorieCalculationMethod &method)
+    {
+        for (int i = 0; i < CALCULATION_METHOD_COUNT; i++)
+        {
+            auto m = static_cast<CalorieCalculationMethod>(i);
+            bool usesBodyFat = withBmrFormula(m, [](auto formula)
+                                              { return formula.usesBodyFat; });
+            cout << i << " - " << getCalculationMethodString(m) << (usesBodyFat ? " (uses body fat)" : "") << endl;
+        }
+        cout << "Select method: ";
+        int methodChoice;
+        cin >> methodChoice;
+        if (!parseCalculationMethod(methodChoice, method))
+        {
+            cout << "Invalid method. Please select a valid option." << endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Reads a body fat percentage, keeping the current one on 0
+    bool readBodyFat(DailyProfile &dailyProfile)
+    {
+        cout << "Enter body fat % (0 to keep " << dailyProfile.getBodyFat() << "): ";
+        double bodyFat;
+        cin >> bodyFat;
+        if (bodyFat < 0 || bodyFat >= 100)
+        {
+            cout << "Invalid body fat. Please enter a percentage below 100." << endl;
+            return false;
+        }
+        if (bodyFat > 0)
+        {
+            dailyProfile.setBodyFat(bodyFat);
+        }
+        return true;
+    }
+
+public:
+    const UserProfile &getUserProfile() const { return userProfile; }
+
+    DirtyTracker &dirtyTracker() { return dirty; }
+
+    ProfileManager(FoodDiary &fd, const string &profileFile, const string &userId = "user")
+        : userProfile(userId), foodDiary(fd), profileFilePath(profileFile)
+    {
+        loadProfile();
+    }
+
+    ~ProfileManager()
+    {
+        if (dirty.isDirty())
+        {
+            saveProfile();
+        }
+    }
+
+    // Load profile from file
+    void loadProfile()
+    {
+        ScopedTimer timer(Instrumentation::LOAD_PROFILE);
+        try
+        {
+            ifstream file(profileFilePath);
+            if (!file.is_open())
+            {
+                cout << "No existing profile found. Starting with default profile." << endl;
+                return;
+            }
+
+            json j;
+            file >> j;
+            Instrumentation::countFile(Instrumentation::BYTES_READ, profileFilePath);
+            userProfile = UserProfile::fromJson(j);
+
+            cout << "Profile loaded successfully." << endl;
+        }
+        catch (const exception &e)
+        {
+            cout << "Error loading profile: " << e.what() << endl;
+        }
+    }
+
+    // Save profile to file, replacing it only once the new one is fully written
+    void saveProfile(bool quiet = false)
+    {
+        ScopedTimer timer(Instrumentation::SAVE_PROFILE);
+        try
+        {
+            DirtyTracker::Snapshot saving = dirty.beginSave();
+            json j = userProfile.toJson();
+
+            string tempPath = profileFilePath + ".tmp";
+            ofstream file(tempPath);
+            string text = j.dump(2);
+            file << text;
+            file.close();
+            if (!file || rename(tempPath.c_str(), profileFilePath.c_str()) != 0)
+            {
+                cout << "Error saving profile: cannot write " << profileFilePath << endl;
+                return;
+            }
+            Instrumentation::count(Instrumentation::BYTES_WRITTEN, text.size());
+            dirty.markSaved(saving);
+            if (!quiet)
+            {
+                cout << "Profile saved successfully." << endl;
+            }
+        }
+        catch (const exception &e)
+        {
+            cout << "Error saving profile: " << e.what() << endl;
+        }
+    }
+
+    // Display user profile
+    void displayUserProfile(Date date)
+    {
+        DailyProfile dailyProfile = userProfile.getDailyProfile(date);
+        cout << "\n===== User Profile for " << date << "=====" << endl;
+        cout << "Gender: " << getGenderString(userProfile.getGender()) << endl;
+        cout << "Height: " << userProfile.getHeight() << " cm" << endl;
+        cout << "Age: " << userProfile.getAge() << " years" << endl;
+        cout << "Calorie calculation method: " << getCalculationMethodString(userProfile.getCalculationMethod()) << endl;
+        cout << "Weight: " << dailyProfile.getWeight() << " kg" << endl;
+        cout << "Body fat: " << dailyProfile.getBodyFat() << " %" << endl;
+        cout << "Activity Level: " << getActivityLevelString(dailyProfile.getActivityLevel()) << endl;
+
+        // Calculate and display calorie goal
+        double calorieTarget = userProfile.calculateDailyCalorieTarget(date);
+        cout << "Daily Calorie Target: " << calorieTarget << " calories" << endl;
+        cout << "=============================" << endl;
+    }
+
+    // Display daily profile for a specific date
+    void displayDailyProfile(Date date)
+    {
+        DailyProfile dailyProfile = userProfile.getDailyProfile(date);
+
+        cout << "\n===== Daily Profile for " << date << " =====" << endl;
+        cout << "Weight: " << dailyProfile.getWeight() << " kg" << endl;
+        cout << "Body fat: " << dailyProfile.getBodyFat() << " %" << endl;
+        cout << "Activity Level: " << getActivityLevelString(dailyProfile.getActivityLevel()) << endl;
+
+        // Calculate and display calorie goal
+        double calorieTarget = userProfile.calculateDailyCalorieTarget(date);
+        cout << "Daily Calorie Target: " << calorieTarget << " calories" << endl;
+    }
+
+    // Calculate and display calorie summary for a date
+    void displayCalorieSummary(Date date)
+    {
+        // Get calorie target
+        double calorieTarget = userProfile.calculateDailyCalorieTarget(date);
+
+        // Calculate consumed calories
+        double consumedCalories = 0.0;
+
+        // This assumes your LogManager class has a method to get the total calories for a date
+        // Modify this part based on your LogManager implementation
+        consumedCalories = foodDiary.getTotalCaloriesForDate(date);
+
+        // Calculate difference
+        double calorieDifference = consumedCalories - calorieTarget;
+
+        cout << "\n===== Calorie Summary for " << date << " =====" << endl;
+        cout << "Target: " << calorieTarget << " calories" << endl;
+        cout << "Consumed: " << consumedCalories << " calories" << endl;
+
+        if (calorieDifference < 0)
+        {
+            cout << "Remaining: " << -calorieDifference << " calories" << endl;
+        }
+        else
+        {
+            cout << "Excess: " << calorieDifference << " calories" << endl;
+        }
+
+        // The week up to this date, with targets from one batch computation
+        Date weekStart = date - 6;
+        vector<double> targets = userProfile.calculateDailyCalorieTargets(weekStart, date);
+        cout << "\nLast 7 days:" << endl;
+        cout << setw(12) << left << "Date" << setw(12) << right << "Target"
+             << setw(12) << right << "Consumed" << setw(12) << right << "Balance" << endl;
+        for (int i = 0; i < 7; i++)
+        {
+            Date day = weekStart + i;
+            double consumed = foodDiary.getTotalCaloriesForDate(day);
+            cout << setw(12) << left << day << setw(12) << right << fixed << setprecision(0) << targets[i]
+                 << setw(12) << right << consumed << setw(12) << right << showpos << consumed - targets[i]
+                 << noshowpos << defaultfloat << setprecision(6) << endl;
+        }
+    }
+
+    // Rolling averages, changes and smoothed trends as of a date
+    TrendReport getTrends(Date date)
+    {
+        return trends.report(date, userProfile, foodDiary);
+    }
+
+    void displayTrends(Date date)
+    {
+        TrendReport report = getTrends(date);
+
+        cout << "\n===== Trends as of " << date << " =====" << endl;
+        auto printSeries = [](const string &title, const RollingSeries &series)
+        {
+            cout << "\n" << title << endl;
+            if (series.empty())
+            {
+                cout << "No data." << endl;
+                return;
+            }
+            cout << setw(10) << left << "Window" << setw(8) << right << "Days" << setw(12) << right << "Average"
+                 << setw(12) << right << "Change" << setw(12) << right << "Smoothed" << endl;
+            for (int w = 0; w < RollingSeries::WINDOW_COUNT; w++)
+            {
+                auto cell = [](double value, bool sign)
+                {
+                    if (isnan(value))
+                    {
+                        cout << setw(12) << right << "-";
+                        return;
+                    }
+                    cout << setw(12) << right << (sign ? showpos : noshowpos) << value << noshowpos;
+                };
+                cout << setw(10) << left << (to_string(RollingSeries::WINDOWS[w]) + " days")
+                     << setw(8) << right << series.valueCount(w) << fixed << setprecision(1);
+                cell(series.average(w), false);
+                cell(series.delta(w), true);
+                cell(series.trend(w), false);
+                cout << defaultfloat << setprecision(6) << endl;
+            }
+        };
+        printSeries("Weight (kg)", report.weight);
+        printSeries("Intake (calories, logged days)", report.intake);
+        printSeries("Intake minus target (calories, logged days)", report.balance);
+        cout << "\nChange compares each window's average with the window before it." << endl;
+    }
+
+    // Projected weight by month and the date a goal weight is reached
+    void displayWeightForecast(Date date)
+    {
+        cout << "\n===== Weight Forecast from " << date << " =====" << endl;
+        cout << "Enter goal weight (kg): ";
+        double goal;
+        cin >> goal;
+        if (goal <= 0)
+        {
+            cout << "Invalid weight. Please enter a valid weight." << endl;
+            cin.ignore();
+            return;
+        }
+        cout << "Months to project (1-60): ";
+        int months;
+        cin >> months;
+        cin.ignore();
+        if (months < 1 || months > 60)
+        {
+            cout << "Invalid number of months." << endl;
+            return;
+        }
+
+        WeightForecaster::Model model = WeightForecaster::modelFor(userProfile, foodDiary, date);
+        int days = date.addMonths(months) - date;
+        WeightForecaster::Projection projection = WeightForecaster::project(model, days, goal);
+
+        cout << fixed << setprecision(1);
+        cout << "Current weight: " << model.weight << " kg" << endl;
+        if (model.intakeHistory.empty())
+        {
+            cout << "No intake logged in the last " << WeightForecaster::HISTORY_DAYS
+                 << " days; assuming today's target of " << model.meanIntake << " calories per day." << endl;
+        }
+        else
+        {
+            cout << "Average intake: " << model.meanIntake << " calories per day over "
+                 << model.intakeHistory.size() << " logged days of the last "
+                 << WeightForecaster::HISTORY_DAYS << "." << endl;
+        }
+
+        cout << "\n" << setw(12) << left << "Date" << setw(12) << right << "Weight (kg)" << endl;
+        for (int month = 1; month <= months; month++)
+        {
+            Date monthDate = date.addMonths(month);
+            cout << setw(12) << left << monthDate << setw(12) << right << projection.weights[monthDate - date] << endl;
+        }
+
+        if (projection.goalDay >= 0)
+        {
+            cout << "\nGoal of " << goal << " kg projected for " << date + projection.goalDay
+                 << " (" << projection.goalDay << " days)." << endl;
+        }
+        else
+        {
+            cout << "\nGoal of " << goal << " kg not reached within " << months << " months." << endl;
+        }
+
+        if (model.intakeHistory.size() < WeightForecaster::MIN_SAMPLES)
+        {
+            cout << "Log at least " << WeightForecaster::MIN_SAMPLES
+                 << " days of intake for a range of outcomes." << endl;
+            cout << defaultfloat << setprecision(6);
+            return;
+        }
+
+        const int runs = 1000;
+        WeightForecaster::MonteCarloResult mc = WeightForecaster::monteCarlo(model, days, goal, runs);
+        using MC = WeightForecaster::MonteCarloResult;
+        cout << "\nMonte Carlo (" << mc.runs << " runs drawing daily intake from logged days):" << endl;
+        cout << "Weight on " << date + days << ": " << MC::percentile(mc.finalWeights, 0.1) << " to "
+             << MC::percentile(mc.finalWeights, 0.9) << " kg (10th-90th percentile), median "
+             << MC::percentile(mc.finalWeights, 0.5) << " kg" << endl;
+        cout << "Goal reached in " << 100.0 * mc.goalDays.size() / mc.runs << "% of runs";
+        if (!mc.goalDays.empty())
+        {
+            cout << "; median date " << date + MC::percentile(mc.goalDays, 0.5) << ", 10th-90th percentile "
+                 << date + MC::percentile(mc.goalDays, 0.1) << " to " << date + MC::percentile(mc.goalDays, 0.9);
+        }
+        cout << "." << endl;
+        cout << defaultfloat << setprecision(6);
+    }
+
+    // Update user profile
+    void updateUserProfile(Date date)
+    {
+        cout << "\n===== Update User Profile for " << date << "=====" << endl;
+
+        cout << "Enter age: ";
+        int age;
+        cin >> age;
+        if (age < 0 || age > 1000) {
+            cout << "Invalid age. Please enter a valid age." << endl;
+            return;
+        }
+        
+        cout << "Enter weight (kg): ";
+        double weight;
+        cin >> weight;
+        if (weight <= 0) {
+            cout << "Invalid weight. Please enter a valid weight." << endl;
+            return;
+        }
+        
+        DailyProfile dailyProfile = userProfile.getDailyProfile(date);
+        
+        cout << "Select activity level (0 = Sedentary, 1 = Lightly Active, "
+        << "2 = Moderately Active, 3 = Very Active, 4 = Extremely Active): ";
+        int activityChoice;
+        cin >> activityChoice;
+        if (activityChoice < 0 || activityChoice > 4) {
+            cout << "Invalid activity level. Please select a valid option." << endl;
+            return;
+        }
+        if (!readBodyFat(dailyProfile))
+        {
+            return;
+        }
+        
+        
+        userProfile.setAge(age);
+        dailyProfile.setWeight(weight);
+        dailyProfile.setActivityLevel(static_cast<ActivityLevel>(activityChoice));
+        userProfile.setDailyProfile(date, dailyProfile);
+
+        cout << "Select calorie calculation method:" << endl;
+        CalorieCalculationMethod method;
+        if (readCalculationMethod(method))
+        {
+            userProfile.setCalculationMethod(method);
+        }
+        dirty.markDirty();
+
+        cin.ignore();
+    }
+
+    // Update daily profile for a specific date
+    void updateDailyProfile(Date date)
+    {
+        DailyProfile dailyProfile = userProfile.getDailyProfile(date);
+
+        cout << "\n===== Update Daily Profile for " << date << " =====" << endl;
+
+        cout << "Enter weight (kg): ";
+        double weight;
+        cin >> weight;
+        dailyProfile.setWeight(weight);
+
+        cout << "Select activity level (0 = Sedentary, 1 = Lightly Active, "
+             << "2 = Moderately Active, 3 = Very Active, 4 = Extremely Active): ";
+        int activityChoice;
+        cin >> activityChoice;
+        dailyProfile.setActivityLevel(static_cast<ActivityLevel>(activityChoice));
+
+        if (readBodyFat(dailyProfile))
         {
-            cout << "Invalid number of servings." << endl;
-            return;
+            userProfile.setDailyProfile(date, dailyProfile);
+            dirty.markDirty();
         }
 
-        // Add the food to the log
-        addFood(currentDate, selectedFood, servings);
+        cin.ignore();
     }
 
-    void deleteFoodFromLog()
+    // Change calculation method
+    void changeCalculationMethod()
     {
-        displayDailyLog(currentDate);
+        cout << "\n===== Change Calculation Method =====" << endl;
+        cout << "Current method: " << getCalculationMethodString(userProfile.getCalculationMethod()) << endl;
+        cout << "Available methods:" << endl;
 
-        auto it = dailyLogs.find(currentDate);
-        if (it == dailyLogs.end() || it->second.empty())
+        CalorieCalculationMethod method;
+        if (!readCalculationMethod(method))
         {
-            cout << "No entries to delete." << endl;
+            cin.ignore();
             return;
         }
+        userProfile.setCalculationMethod(method);
+        dirty.markDirty();
+
+        cout << "Calculation method changed to "
+             << getCalculationMethodString(userProfile.getCalculationMethod()) << endl;
 
-        cout << "Enter entry number to delete: ";
-        int index;
-        cin >> index;
         cin.ignore();
+    }
+};
+
 
-        if (index < 1 || index > static_cast<int>(it->second.size()))
+// Request handlers shared by script mode and the RPC server. Each takes its
+// arguments as a JSON object and returns its result as JSON; bad arguments throw
+// invalid_argument. Callers are responsible for locking.
+struct DietRequests
+{
+    // Date from args[key], or fallback when absent
+    static Date dateArg(const json &args, const char *key, Date fallback)
+    {
+        if (!args.contains(key))
         {
-            cout << "Invalid entry number." << endl;
-            return;
+            return fallback;
         }
-
-        deleteFood(currentDate, index - 1);
+        Date date;
+        if (!Date::parse(args[key].get<string>(), date))
+        {
+            throw invalid_argument(string("invalid ") + key + ", expected YYYY-MM-DD with a year from " +
+                                   to_string(Date::MIN_YEAR) + " to " + to_string(Date::MAX_YEAR));
+        }
+        return date;
     }
 
-    void changeDate()
+    // {name, keywords, calories} for a basic food or {name, keywords, components:
+    // [{name, servings}]} for a composite one
+    static json addFood(FoodDatabaseManager &db, const json &args)
     {
-        cout << "Enter date (YYYY-MM-DD): ";
-        string date;
-        cin >> date;
-        cin.ignore();
-
-        setCurrentDate(date);
+        string name = args.at("name").get<string>();
+        if (name.empty())
+        {
+            throw invalid_argument("name must not be empty");
+        }
+        if (db.getFood(name))
+        {
+            throw invalid_argument("food already exists: " + name);
+        }
+        vector<string> keywords = args.value("keywords", vector<string>());
+        shared_ptr<Food> food;
+        if (args.contains("components"))
+        {
+            vector<FoodComponent> components;
+            for (const json &component : args["components"])
+            {
+                string componentName = component.at("name").get<string>();
+                shared_ptr<Food> componentFood = db.getFood(componentName);
+                if (!componentFood)
+                {
+                    throw invalid_argument("unknown component: " + componentName);
+                }
+                float servings = component.value("servings", 1.0f);
+                if (!(servings > 0) || !isfinite(servings))
+                {
+                    throw invalid_argument("servings of " + componentName + " must be a positive number");
+                }
+                components.emplace_back(componentFood, servings);
+            }
+            food = make_shared<CompositeFood>(name, keywords, components);
+        }
+        else
+        {
+            float calories = args.at("calories").get<float>();
+            if (!(calories >= 0) || !isfinite(calories))
+            {
+                throw invalid_argument("calories must be a non-negative number");
+            }
+            food = make_shared<BasicFood>(name, keywords, calories);
+        }
+        db.addFood(food);
+        return {{"name", name}, {"calories", food->getCalories()}};
     }
 
-    void showUndoStack() const
+    // {keywords, match: "all" (default) or "any", min_calories, max_calories, limit}
+    static json searchFoods(const FoodDatabaseManager &db, const json &args)
     {
-        if (undoStack.empty())
+        vector<string> keywords = args.value("keywords", vector<string>());
+        bool matchAll = args.value("match", string("all")) != "any";
+        float minCalories = args.value("min_calories", 0.0f);
+        float maxCalories = args.value("max_calories", numeric_limits<float>::max());
+        if (!isfinite(minCalories) || !isfinite(maxCalories) || minCalories > maxCalories)
         {
-            cout << "Undo stack is empty." << endl;
-            return;
+            throw invalid_argument("min_calories and max_calories must be finite, with min_calories <= max_calories");
+        }
+        size_t limit = args.value("limit", numeric_limits<size_t>::max());
+        ScopedTimer timer(Instrumentation::SEARCH);
+        json foods = json::array();
+        for (FoodHandle food : db.queryFoods(keywords, matchAll, minCalories, maxCalories))
+        {
+            if (foods.size() == limit)
+                break;
+            foods.push_back({{"name", food->getName()}, {"calories", food->getCalories()}});
         }
+        return {{"foods", move(foods)}};
+    }
 
-        cout << "\nUndo Stack (latest first):\n";
+    static json getFood(const FoodDatabaseManager &db, const json &args)
+    {
+        string name = args.at("name").get<string>();
+        shared_ptr<Food> food = db.getFood(name);
+        if (!food)
+        {
+            throw invalid_argument("unknown food: " + name);
+        }
+        return food->toJson();
+    }
 
-        // Create a temporary stack to display in reverse order
-        stack<shared_ptr<Command>> tempStack = undoStack;
-        int count = 1;
+    // {food, servings (default 1), date}
+    static json logFood(FoodDiary &diary, const json &args)
+    {
+        Date date = dateArg(args, "date", diary.getCurrentDate());
+        string name = args.at("food").get<string>();
+        double calories = diary.logFood(date, name, args.value("servings", 1.0));
+        if (calories < 0)
+        {
+            throw invalid_argument("unknown food: " + name);
+        }
+        return {{"date", date.toString()}, {"index", diary.entryCount(date) - 1}, {"calories", calories}};
+    }
 
-        while (!tempStack.empty())
+    // {index, date}
+    static json deleteEntry(FoodDiary &diary, const json &args)
+    {
+        Date date = dateArg(args, "date", diary.getCurrentDate());
+        if (!diary.deleteEntryAt(date, args.at("index").get<size_t>()))
         {
-            cout << count++ << ". " << tempStack.top()->getDescription() << endl;
-            tempStack.pop();
+            throw invalid_argument("no entry with that index on " + date.toString());
         }
+        return json::object();
+    }
 
-        cout << endl;
+    static json undo(FoodDiary &diary)
+    {
+        bool applied;
+        string description = diary.undoLast(applied);
+        if (description.empty())
+        {
+            throw invalid_argument("nothing to undo");
+        }
+        return {{"undone", description}, {"applied", applied}};
     }
-    double getTotalCaloriesForDate(const string &date) const
+
+    // Logged days' totals in [from, to], at most a year at a time
+    static json dailyTotals(const FoodDiary &diary, const json &args)
     {
-        auto it = dailyLogs.find(date);
-        if (it == dailyLogs.end())
+        Date to = dateArg(args, "to", diary.getCurrentDate());
+        Date from = dateArg(args, "from", to - 6);
+        if (to < from || to - from > 366)
+        {
+            throw invalid_argument("from must be on or before to, at most 366 days apart");
+        }
+        json days = json::array();
+        for (Date date = from; date <= to; date = date + 1)
         {
-            return 0.0;
+            CalorieRangeSummary day = diary.getCalorieSummaryForRange(date, date);
+            if (day.loggedDays)
+                days.push_back({{"date", date.toString()}, {"calories", day.total}});
         }
+        CalorieRangeSummary range = diary.getCalorieSummaryForRange(from, to);
+        return {{"days", move(days)}, {"total", range.total}, {"logged_days", range.loggedDays}};
+    }
 
-        double totalCalories = 0.0;
-        for (const auto &entry : it->second)
+    // {date, entries: true for the day's entries}
+    static json daySummary(FoodDiary &diary, const ProfileManager &profiles, const json &args)
+    {
+        Date date = dateArg(args, "date", diary.getCurrentDate());
+        const UserProfile &profile = profiles.getUserProfile();
+        const DailyProfile &daily = profile.getEffectiveProfile(date);
+        double consumed = diary.getTotalCaloriesForDate(date);
+        double target = profile.calculateDailyCalorieTarget(date);
+        json result = {{"date", date.toString()},
+                       {"consumed", consumed},
+                       {"target", target},
+                       {"remaining", target - consumed},
+                       {"count", diary.entryCount(date)},
+                       {"weight", daily.getWeight()},
+                       {"method", withBmrFormula(profile.getCalculationMethod(), [](auto formula)
+                                                 { return string(formula.name); })}};
+        if (args.value("entries", false))
         {
-            totalCalories += entry.calories;
+            json entries = json::array();
+            diary.forEachEntry(date, date, [&](Date, const string &food, double servings, double calories)
+                               { entries.push_back({{"food", food}, {"servings", servings}, {"calories", calories}}); });
+            result["entries"] = move(entries);
         }
-        return totalCalories;
+        return result;
     }
 };
 
-// Class to store user's daily profile information
-class DailyProfile
+// One user's diary and profile, loaded on first use. The mutex serializes the
+// operations on this user; other users' shards are independent.
+struct UserShard
 {
-private:
-    double weight; // in kg
-    ActivityLevel activityLevel;
+    string userId;
+    string logPath;
+    string profilePath;
+    mutex lock;
+    unique_ptr<FoodDiary> diary;
+    unique_ptr<ProfileManager> profiles; // declared last so it is destroyed first
+
+    void ensureLoaded(FoodDatabaseManager &db)
+    {
+        if (!diary)
+        {
+            diary = make_unique<FoodDiary>(db, logPath);
+            profiles = make_unique<ProfileManager>(*diary, profilePath, userId);
+        }
+    }
+};
 
+// Hosts many users against one shared food database. User shards are loaded on
+// demand and the least recently used idle ones are evicted once more than
+// maxResident are in memory; eviction is safe at any time because diary changes
+// are already journaled and the profile is saved when its shard is destroyed.
+//
+// Per-user operations on different users run concurrently. Each holds a lock on
+// its own shard and a shared lock on the catalog; catalog changes take the
+// catalog lock exclusively.
+class UserRegistry
+{
 public:
-    DailyProfile(double w = 70.0, ActivityLevel a = ActivityLevel::MODERATELY_ACTIVE)
-        : weight(w), activityLevel(a) {}
+    // A checked-out user. The shard stays resident and no other thread can use
+    // this user until the lease is released.
+    class Lease
+    {
+    private:
+        shared_ptr<UserShard> shard;
+        unique_lock<mutex> shardLock;
 
-    double getWeight() const { return weight; }
-    void setWeight(double w) { weight = w; }
+    public:
+        Lease() = default;
+        explicit Lease(shared_ptr<UserShard> s) : shard(move(s)), shardLock(shard->lock) {}
 
-    ActivityLevel getActivityLevel() const { return activityLevel; }
-    void setActivityLevel(ActivityLevel a) { activityLevel = a; }
+        // Stays empty if another thread holds the shard
+        Lease(shared_ptr<UserShard> s, try_to_lock_t) : shardLock(s->lock, try_to_lock)
+        {
+            if (shardLock)
+                shard = move(s);
+        }
+        Lease(Lease &&other) noexcept = default;
 
-    json toJson() const
+        // Unlocks the old shard before letting go of it
+        Lease &operator=(Lease &&other) noexcept
+        {
+            shardLock = move(other.shardLock);
+            shard = move(other.shard);
+            return *this;
+        }
+
+        explicit operator bool() const { return shard != nullptr; }
+        const string &userId() const { return shard->userId; }
+        shared_ptr<UserShard> pin() const { return shard; }
+        FoodDiary &diary() const { return *shard->diary; }
+        ProfileManager &profiles() const { return *shard->profiles; }
+    };
+
+private:
+    FoodDatabaseManager &dbManager;
+    string usersDir;
+    size_t maxResident;
+
+    // The default user keeps the original single-user files
+    string defaultUserId;
+    string defaultLogPath;
+    string defaultProfilePath;
+
+    mutex registryLock; // guards shards, recency and closing only
+    unordered_map<string, pair<shared_ptr<UserShard>, list<string>::iterator>> shards;
+    list<string> recency;          // most recently used first
+    unordered_set<string> closing; // evicted users whose shards are still being torn down
+    condition_variable closed;     // signalled as closing shrinks
+    shared_mutex catalogLock;
+
+    // Changed per-serving calories waiting to be applied to each user's diary, by
+    // the repricer thread or by whoever checks that user out first
+    map<string, map<string, double>> pendingReprices; // guarded by registryLock
+    thread repricer;
+    bool repricerRunning = false; // guarded by registryLock
+    size_t repricedUsers = 0;     // since takeRepricedUsers last reported
+
+    // Removes idle shards from the tail of the recency list until within capacity.
+    // The shards are handed back so they are destroyed outside the registry lock;
+    // their users stay in closing until closeShards has finished with them.
+    vector<shared_ptr<UserShard>> evictLocked()
     {
-        json j;
-        j["weight"] = weight;
-        j["activityLevel"] = static_cast<int>(activityLevel);
-        return j;
+        vector<shared_ptr<UserShard>> evicted;
+        auto it = recency.end();
+        while (shards.size() > maxResident && it != recency.begin())
+        {
+            --it;
+            auto entry = shards.find(*it);
+            if (entry->second.first.use_count() > 1)
+                continue; // leased or being loaded
+            closing.insert(*it);
+            evicted.push_back(move(entry->second.first));
+            shards.erase(entry);
+            it = recency.erase(it);
+        }
+        return evicted;
     }
 
-    static DailyProfile fromJson(const json &j)
+    // Destroys evicted shards, which saves their profiles and finishes their
+    // compactions, then lets acquire load those users from disk again
+    void closeShards(vector<shared_ptr<UserShard>> evicted)
     {
-        return DailyProfile(
-            j["weight"].get<double>(),
-            static_cast<ActivityLevel>(j["activityLevel"].get<int>()));
+        if (evicted.empty())
+            return;
+        vector<string> userIds;
+        for (const auto &shard : evicted)
+            userIds.push_back(shard->userId);
+        evicted.clear();
+
+        lock_guard<mutex> guard(registryLock);
+        for (const string &userId : userIds)
+            closing.erase(userId);
+        closed.notify_all();
     }
-};
-
-// Class to represent user's unchanging profile information
-class UserProfile
-{
-private:
-    string userId;
-    Gender gender;
-    double height; // in cm
-    int age;
-    CalorieCalculationMethod calculationMethod;
-    unordered_map<string, DailyProfile> dailyProfiles;
 
-    // Calculate BMR using Harris-Benedict equation
-    double calculateBMRHarrisBenedict(double weight) const
+    // Checks a user out as acquire does; without wait, returns an empty lease
+    // instead of blocking while another thread holds the user
+    Lease checkOut(const string &userId, bool wait)
     {
-        if (gender == Gender::MALE)
+        if (!isValidUserId(userId))
         {
-            return 66.5 + (13.75 * weight) + (5.003 * height) - (6.75 * age);
+            throw invalid_argument("invalid user id: " + userId);
         }
-        else
+
+        shared_ptr<UserShard> shard;
+        vector<shared_ptr<UserShard>> evicted;
+        bool repricePending;
         {
-            return 655.1 + (9.563 * weight) + (1.850 * height) - (4.676 * age);
+            unique_lock<mutex> guard(registryLock);
+            closed.wait(guard, [&]
+                        { return closing.count(userId) == 0; });
+            auto it = shards.find(userId);
+            if (it != shards.end())
+            {
+                recency.splice(recency.begin(), recency, it->second.second);
+                shard = it->second.first;
+            }
+            else
+            {
+                shard = make_shared<UserShard>();
+                shard->userId = userId;
+                bool isDefault = userId == defaultUserId;
+                shard->logPath = isDefault ? defaultLogPath : usersDir + "/" + userId + "/food_log.json";
+                shard->profilePath = isDefault ? defaultProfilePath : usersDir + "/" + userId + "/user_profile.json";
+                recency.push_front(userId);
+                shards.emplace(userId, make_pair(shard, recency.begin()));
+            }
+            evicted = evictLocked();
+            repricePending = !pendingReprices.empty();
         }
+        closeShards(move(evicted));
+
+        Lease lease = wait ? Lease(shard) : Lease(shard, try_to_lock);
+        if (!lease)
+            return lease;
+        shard->ensureLoaded(dbManager);
+        if (repricePending)
+            startPendingReprice(lease);
+        return lease;
     }
 
-    // Calculate BMR using Mifflin-St Jeor equation
-    double calculateBMRMifflinStJeor(double weight) const
+    // Hands the user's waiting price changes to its diary, whose own workers
+    // reprice it; the diary swaps the result in when it is next polled
+    void startPendingReprice(const Lease &lease)
     {
-        if (gender == Gender::MALE)
-        {
-            return (10 * weight) + (6.25 * height) - (5 * age) + 5;
-        }
-        else
+        map<string, double> prices;
         {
-            return (10 * weight) + (6.25 * height) - (5 * age) - 161;
+            lock_guard<mutex> guard(registryLock);
+            auto it = pendingReprices.find(lease.userId());
+            if (it == pendingReprices.end())
+                return;
+            prices = move(it->second);
+            pendingReprices.erase(it);
+            repricedUsers++;
         }
+        lease.diary().startRepricing(prices, true);
     }
 
-    // Get activity multiplier based on activity level
-    double getActivityMultiplier(ActivityLevel level) const
+    // Repricer thread body: works through the waiting users one at a time. A user
+    // another thread holds is left to that thread, which started its re-pricing
+    // when it checked the user out.
+    void repricePendingUsers()
     {
-        switch (level)
+        set<string> busy;
+        for (;;)
         {
-        case ActivityLevel::SEDENTARY:
-            return 1.2;
-        case ActivityLevel::LIGHTLY_ACTIVE:
-            return 1.375;
-        case ActivityLevel::MODERATELY_ACTIVE:
-            return 1.55;
-        case ActivityLevel::VERY_ACTIVE:
-            return 1.725;
-        case ActivityLevel::EXTREMELY_ACTIVE:
-            return 1.9;
-        default:
-            return 1.55; // Moderate activity default
+            string userId;
+            {
+                lock_guard<mutex> guard(registryLock);
+                auto it = find_if(pendingReprices.begin(), pendingReprices.end(), [&](const auto &pending)
+                                  { return busy.count(pending.first) == 0; });
+                if (it == pendingReprices.end())
+                {
+                    repricerRunning = false;
+                    return;
+                }
+                userId = it->first;
+            }
+            Lease lease = checkOut(userId, false);
+            if (!lease)
+            {
+                busy.insert(userId);
+                continue;
+            }
+            lease.diary().finishRepricing();
         }
     }
 
 public:
-    UserProfile(
-        string id = "user",
-        Gender g = Gender::OTHER,
-        double h = 170.0,
-        int a = 30,
-        CalorieCalculationMethod m = CalorieCalculationMethod::MIFFLIN_ST_JEOR) : userId(id), gender(g), height(h), age(a), calculationMethod(m) {}
+    UserRegistry(FoodDatabaseManager &db, const string &defaultUser, const string &logPath,
+                 const string &profilePath, const string &directory = "users", size_t residentUsers = 64)
+        : dbManager(db), usersDir(directory), maxResident(max<size_t>(1, residentUsers)),
+          defaultUserId(defaultUser), defaultLogPath(logPath), defaultProfilePath(profilePath)
+    {
+    }
 
-    // Getters and setters
-    string getUserId() const { return userId; }
+    // User ids name directories, so they are limited to a safe character set
+    static bool isValidUserId(const string &userId)
+    {
+        if (userId.empty() || userId.size() > 64 || userId == "." || userId == "..")
+            return false;
+        return all_of(userId.begin(), userId.end(), [](char c)
+                      { return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-' || c == '.'; });
+    }
 
-    Gender getGender() const { return gender; }
-    void setGender(Gender g) { gender = g; }
+    // Checks a user out, loading the shard if needed. Blocks while another thread
+    // holds the same user, or while an evicted shard of the user is still writing
+    // its files. Throws invalid_argument for an unusable user id.
+    Lease acquire(const string &userId)
+    {
+        return checkOut(userId, true);
+    }
 
-    double getHeight() const { return height; }
-    void setHeight(double h) { height = h; }
+    // Runs fn(diary, profiles) for one user; safe to call from many threads
+    template <typename Fn>
+    auto withUser(const string &userId, Fn fn)
+    {
+        shared_lock<shared_mutex> catalog(catalogLock);
+        Lease lease = acquire(userId);
+        return fn(lease.diary(), lease.profiles());
+    }
 
-    int getAge() const { return age; }
-    void setAge(int a) { age = a; }
+    // Like withUser, and keeps the shard resident through pin after the lease is
+    // released: a pinned shard is never evicted, so changes left pending under
+    // group commit are still there for withPinned to commit
+    template <typename Fn>
+    auto withPinnedUser(const string &userId, shared_ptr<UserShard> &pin, Fn fn)
+    {
+        shared_lock<shared_mutex> catalog(catalogLock);
+        Lease lease = acquire(userId);
+        pin = lease.pin();
+        return fn(lease.diary(), lease.profiles());
+    }
 
-    CalorieCalculationMethod getCalculationMethod() const { return calculationMethod; }
-    void setCalculationMethod(CalorieCalculationMethod m) { calculationMethod = m; }
+    // Runs fn(diary, profiles) on a shard pinned by withPinnedUser
+    template <typename Fn>
+    auto withPinned(const shared_ptr<UserShard> &pin, Fn fn)
+    {
+        shared_lock<shared_mutex> catalog(catalogLock);
+        Lease lease(pin);
+        return fn(lease.diary(), lease.profiles());
+    }
 
-    // Calculate daily calorie target
-    double calculateDailyCalorieTarget(const string &date)
+    // Runs fn(database) with the catalog to itself, for adding or changing foods
+    template <typename Fn>
+    auto withCatalog(Fn fn)
+    {
+        unique_lock<shared_mutex> catalog(catalogLock);
+        return fn(dbManager);
+    }
+
+    // Runs fn(database) for lookups; any number of readers run together
+    template <typename Fn>
+    auto readCatalog(Fn fn)
+    {
+        shared_lock<shared_mutex> catalog(catalogLock);
+        return fn(static_cast<const FoodDatabaseManager &>(dbManager));
+    }
+
+    const string &defaultUser() const { return defaultUserId; }
+
+    // Queues changed per-serving calories for the diary of every stored user but
+    // exceptUser, found among the resident shards and the directories under
+    // usersDir, and reprices them on the repricer thread. Returns how many
+    // diaries were queued; takeRepricedUsers reports when they are done.
+    size_t repriceOtherUsers(const string &exceptUser, const map<string, double> &caloriesPerServing)
     {
-        if (dailyProfiles.find(date) == dailyProfiles.end())
+        set<string> userIds = {defaultUserId};
+        {
+            lock_guard<mutex> guard(registryLock);
+            for (const auto &[userId, entry] : shards)
+                userIds.insert(userId);
+        }
+        error_code ec;
+        for (const auto &entry : filesystem::directory_iterator(usersDir, ec))
         {
-            // If no profile exists for this date, copy from most recent day or use default
-            setDailyProfileFromMostRecent(date);
+            string userId = entry.path().filename().string();
+            if (entry.is_directory() && isValidUserId(userId))
+                userIds.insert(userId);
         }
 
-        const DailyProfile &profile = dailyProfiles[date];
-        double bmr = 0.0;
+        userIds.erase(exceptUser);
+        if (userIds.empty())
+            return 0;
 
-        // Calculate BMR based on selected method
-        if (calculationMethod == CalorieCalculationMethod::HARRIS_BENEDICT)
+        lock_guard<mutex> guard(registryLock);
+        for (const string &userId : userIds)
         {
-            bmr = calculateBMRHarrisBenedict(profile.getWeight());
+            map<string, double> &prices = pendingReprices[userId];
+            for (const auto &[name, perServing] : caloriesPerServing)
+                prices[name] = perServing;
         }
-        else
+        if (!repricerRunning)
         {
-            bmr = calculateBMRMifflinStJeor(profile.getWeight());
+            // A finished repricer has already given up the lock for good
+            if (repricer.joinable())
+                repricer.join();
+            repricerRunning = true;
+            repricer = thread(&UserRegistry::repricePendingUsers, this);
         }
+        return userIds.size();
+    }
 
-        // Apply activity multiplier
-        return bmr * getActivityMultiplier(profile.getActivityLevel());
+    // How many users' diaries were repriced since the last call, once the
+    // repricer thread is idle; 0 while it still runs
+    size_t takeRepricedUsers()
+    {
+        lock_guard<mutex> guard(registryLock);
+        if (repricerRunning)
+            return 0;
+        return exchange(repricedUsers, 0);
     }
 
-    // Check if a profile exists for a specific date
-    bool hasProfileForDate(const string &date) const
+    size_t residentCount()
     {
-        return dailyProfiles.find(date) != dailyProfiles.end();
+        lock_guard<mutex> guard(registryLock);
+        return shards.size();
+    }
+
+    // Lets the repricer finish, so no queued price change is lost
+    ~UserRegistry()
+    {
+        if (repricer.joinable())
+            repricer.join();
+    }
+
+    // Drops every idle shard, e.g. before shutdown or to release memory
+    void evictIdle()
+    {
+        vector<shared_ptr<UserShard>> evicted;
+        {
+            lock_guard<mutex> guard(registryLock);
+            size_t keep = maxResident;
+            maxResident = 0;
+            evicted = evictLocked();
+            maxResident = keep;
+        }
+        closeShards(move(evicted));
+    }
+};
+
+// JSON-RPC 2.0 over a Unix domain socket, one request or response per line. A
+// poll loop reads every connection and hands complete requests to a fixed pool
+// of workers. Requests on one connection run in order, and different
+// connections run in parallel, with the user registry doing the locking
+// (per-user work holds that user's shard and a shared catalog lock, catalog
+// changes hold the catalog exclusively). A worker takes all the requests a
+// client has pipelined, up to maxBatch, and group-commits their diary changes:
+// one journal sync per user before any of the responses is sent.
+//
+// Methods, with params as an object; "user" picks the diary and profile:
+//   catalog.search   {keywords, match: "all"|"any", min_calories, max_calories, limit}
+//                    (a reversed or non-finite calorie range is invalid params, -32602)
+//   catalog.getFood  {name}
+//   catalog.add      {name, keywords, calories | components: [{name, servings}]}
+//   diary.log        {food, servings, date}
+//   diary.delete     {index, date}
+//   diary.undo       {}
+//   diary.totals     {from, to}
+//   profile.summary  {date, entries}
+class RpcServer
+{
+private:
+    struct RpcError : runtime_error
+    {
+        int code;
+        RpcError(int c, const string &message) : runtime_error(message), code(c) {}
+    };
+
+    struct Connection
+    {
+        int fd;
+        string input;          // bytes read but not yet split into lines
+        deque<string> pending; // complete requests waiting for a worker
+        bool busy = false;     // a worker is running one of its requests
+        bool hangup = false;   // the client closed its end
+    };
+
+    static const size_t maxLineBytes = 1 << 20;
+    static const size_t maxBatch = 64;
+
+    UserRegistry &users;
+    string socketPath;
+    size_t workerCount;
+    int listenFd = -1;
+
+    mutex lock; // guards connections, ready and stopping
+    condition_variable jobReady;
+    unordered_map<int, Connection> connections;
+    deque<int> ready; // connections with a request for a worker
+    bool stopping = false;
+
+    // Written by the signal handler and by workers to wake the poll loop. Both
+    // ends are non-blocking: a full pipe already holds a pending wake-up, so a
+    // write that would block is dropped, and the poll loop drains it completely.
+    // A shutdown signal is carried by stopRequested, which no full pipe can lose.
+    static int wakeFds[2];
+    static volatile sig_atomic_t stopRequested;
+
+    // Users whose diaries this worker's current batch changed, pinned so their
+    // uncommitted changes cannot be evicted before commitTouchedUsers
+    static thread_local map<string, shared_ptr<UserShard>> touchedUsers;
+
+    static void onSignal(int)
+    {
+        stopRequested = 1;
+        wake();
+    }
+
+    // Only async-signal-safe calls, since onSignal uses it too; EAGAIN means a
+    // wake-up is already pending
+    static void wake()
+    {
+        int savedErrno = errno;
+        char byte = 'w';
+        ssize_t ignored = ::write(wakeFds[1], &byte, 1);
+        (void)ignored;
+        errno = savedErrno;
+    }
+
+    static void sendAll(int fd, const string &data)
+    {
+        size_t sent = 0;
+        while (sent < data.size())
+        {
+            ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return; // the client is gone; its hangup is noticed by the poll loop
+            sent += static_cast<size_t>(n);
+        }
+    }
+
+    json call(const string &method, const json &params)
+    {
+        if (method == "catalog.search")
+            return users.readCatalog([&](const FoodDatabaseManager &db)
+                                     { return DietRequests::searchFoods(db, params); });
+        if (method == "catalog.getFood")
+            return users.readCatalog([&](const FoodDatabaseManager &db)
+                                     { return DietRequests::getFood(db, params); });
+        if (method == "catalog.add")
+            return users.withCatalog([&](FoodDatabaseManager &db)
+                                     { return DietRequests::addFood(db, params); });
+
+        string user = params.value("user", users.defaultUser());
+        auto withUser = [&](auto fn)
+        {
+            return users.withPinnedUser(user, touchedUsers[user], [&](FoodDiary &diary, ProfileManager &profiles)
+                                        {
+                                            diary.setGroupCommit(true);
+                                            return fn(diary, profiles); });
+        };
+        if (method == "diary.log")
+            return withUser([&](FoodDiary &diary, ProfileManager &)
+                            { return DietRequests::logFood(diary, params); });
+        if (method == "diary.delete")
+            return withUser([&](FoodDiary &diary, ProfileManager &)
+                            { return DietRequests::deleteEntry(diary, params); });
+        if (method == "diary.undo")
+            return withUser([&](FoodDiary &diary, ProfileManager &)
+                            { return DietRequests::undo(diary); });
+        if (method == "diary.totals")
+            return withUser([&](FoodDiary &diary, ProfileManager &)
+                            { return DietRequests::dailyTotals(diary, params); });
+        if (method == "profile.summary")
+            return withUser([&](FoodDiary &diary, ProfileManager &profiles)
+                            { return DietRequests::daySummary(diary, profiles, params); });
+        throw RpcError(-32601, "method not found: " + method);
     }
 
-    // Set daily profile for a specific date
-    void setDailyProfile(const string &date, const DailyProfile &profile)
+    // The response line for one request line; empty for notifications (no id)
+    string handle(const string &line)
     {
-        dailyProfiles[date] = profile;
+        json response = {{"jsonrpc", "2.0"}, {"id", nullptr}};
+        json request;
+        try
+        {
+            request = json::parse(line);
+            if (!request.is_object() || !request.contains("method") || !request["method"].is_string())
+                throw RpcError(-32600, "invalid request");
+            response["id"] = request.value("id", json());
+            json params = request.value("params", json::object());
+            if (!params.is_object())
+                throw RpcError(-32602, "params must be an object");
+            json result = call(request["method"].get<string>(), params);
+            if (!request.contains("id"))
+                return "";
+            response["result"] = move(result);
+        }
+        catch (const RpcError &e)
+        {
+            response["error"] = {{"code", e.code}, {"message", e.what()}};
+        }
+        catch (const json::parse_error &e)
+        {
+            response["error"] = {{"code", -32700}, {"message", e.what()}};
+        }
+        catch (const json::exception &e)
+        {
+            response["error"] = {{"code", -32602}, {"message", e.what()}};
+        }
+        catch (const invalid_argument &e)
+        {
+            response["error"] = {{"code", -32602}, {"message", e.what()}};
+        }
+        catch (const exception &e)
+        {
+            response["error"] = {{"code", -32603}, {"message", e.what()}};
+        }
+        return response.dump() + "\n";
     }
 
-    // Get daily profile for a specific date
-    DailyProfile getDailyProfile(const string &date)
+    // Syncs the journals of the users a batch changed. Any worker's commit also
+    // covers changes other workers left pending for the same user, so every
+    // change is durable before the worker that made it replies.
+    void commitTouchedUsers()
     {
-        if (dailyProfiles.find(date) == dailyProfiles.end())
+        for (const auto &[user, pin] : touchedUsers)
         {
-            setDailyProfileFromMostRecent(date);
+            if (pin)
+                users.withPinned(pin, [](FoodDiary &diary, ProfileManager &)
+                                 { diary.setGroupCommit(false); return 0; });
         }
-        return dailyProfiles[date];
+        touchedUsers.clear();
     }
 
-    // Set profile for a date based on most recent available profile
-    void setDailyProfileFromMostRecent(const string &targetDate)
+    void workerLoop()
     {
-        // If no profiles exist yet, create a default one
-        if (dailyProfiles.empty())
+        unique_lock<mutex> guard(lock);
+        while (true)
         {
-            dailyProfiles[targetDate] = DailyProfile();
-            return;
+            jobReady.wait(guard, [this]
+                          { return stopping || !ready.empty(); });
+            if (stopping)
+                return;
+            int fd = ready.front();
+            ready.pop_front();
+            deque<string> &pending = connections[fd].pending;
+            vector<string> batch;
+            while (!pending.empty() && batch.size() < maxBatch)
+            {
+                batch.push_back(move(pending.front()));
+                pending.pop_front();
+            }
+
+            guard.unlock();
+            string responses;
+            for (const string &request : batch)
+                responses += handle(request);
+            commitTouchedUsers();
+            if (!responses.empty())
+                sendAll(fd, responses);
+            guard.lock();
+
+            Connection &connection = connections[fd];
+            if (!connection.pending.empty())
+            {
+                ready.push_back(fd);
+                jobReady.notify_one();
+            }
+            else
+            {
+                connection.busy = false;
+                if (connection.hangup)
+                    wake(); // the poll loop closes it
+            }
         }
+    }
 
-        // Find the most recent date before the target date
-        string mostRecentDate = "";
-        for (const auto &[date, _] : dailyProfiles)
+    // Reads what a connection has sent and queues its complete lines
+    void readFrom(Connection &connection)
+    {
+        char chunk[65536];
+        while (true)
         {
-            if (date <= targetDate && (mostRecentDate.empty() || date > mostRecentDate))
+            ssize_t n = ::recv(connection.fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+            if (n > 0)
             {
-                mostRecentDate = date;
+                connection.input.append(chunk, static_cast<size_t>(n));
+                continue;
             }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                connection.hangup = true;
+            break;
         }
 
-        // If found, copy that profile; otherwise use the earliest available profile
-        if (!mostRecentDate.empty())
+        size_t start = 0, end;
+        while ((end = connection.input.find('\n', start)) != string::npos)
         {
-            dailyProfiles[targetDate] = dailyProfiles[mostRecentDate];
+            if (end > start)
+                connection.pending.emplace_back(connection.input, start, end - start);
+            start = end + 1;
         }
-        else {
-            dailyProfiles[targetDate] = DailyProfile();
+        connection.input.erase(0, start);
+        if (connection.input.size() > maxLineBytes)
+        {
+            cerr << "Dropping RPC client sending an oversized request" << endl;
+            connection.hangup = true;
+            connection.pending.clear();
         }
-        // else
-        // {
-        //     // Find earliest date
-        //     string earliestDate = dailyProfiles.begin()->first;
-        //     for (const auto &[date, _] : dailyProfiles)
-        //     {
-        //         if (date < earliestDate)
-        //         {
-        //             earliestDate = date;
-        //         }
-        //     }
-        //     dailyProfiles[targetDate] = dailyProfiles[earliestDate];
-        // }
-    }
-
-    // Save profile to JSON
-    json toJson() const
-    {
-        json j;
-        j["userId"] = userId;
-        j["gender"] = static_cast<int>(gender);
-        j["height"] = height;
-        j["age"] = age;
-        j["calculationMethod"] = static_cast<int>(calculationMethod);
 
-        json dailyProfilesJson;
-        for (const auto &[date, profile] : dailyProfiles)
+        if (!connection.busy && !connection.pending.empty())
         {
-            dailyProfilesJson[date] = profile.toJson();
+            connection.busy = true;
+            ready.push_back(connection.fd);
+            jobReady.notify_one();
         }
-        j["dailyProfiles"] = dailyProfilesJson;
-
-        return j;
     }
 
-    // Load profile from JSON
-    static UserProfile fromJson(const json &j)
-    {
-        UserProfile profile(
-            j["userId"].get<string>(),
-            static_cast<Gender>(j["gender"].get<int>()),
-            j["height"].get<double>(),
-            j["age"].get<int>(),
-            static_cast<CalorieCalculationMethod>(j["calculationMethod"].get<int>()));
+public:
+    RpcServer(UserRegistry &registry, const string &path, size_t workers)
+        : users(registry), socketPath(path), workerCount(max<size_t>(1, workers)) {}
 
-        if (j.contains("dailyProfiles"))
+    // Serves until SIGINT or SIGTERM. Returns false if the socket cannot be opened.
+    bool run()
+    {
+        sockaddr_un address{};
+        if (socketPath.size() >= sizeof(address.sun_path))
+        {
+            cerr << "Error: socket path too long: " << socketPath << endl;
+            return false;
+        }
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+        listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        ::unlink(socketPath.c_str());
+        if (listenFd < 0 || ::bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+            ::listen(listenFd, SOMAXCONN) != 0 ||
+            ::pipe2(wakeFds, O_NONBLOCK | O_CLOEXEC) != 0)
+        {
+            cerr << "Error: cannot listen on " << socketPath << ": " << strerror(errno) << endl;
+            if (listenFd >= 0)
+                ::close(listenFd);
+            return false;
+        }
+        stopRequested = 0;
+        signal(SIGINT, onSignal);
+        signal(SIGTERM, onSignal);
+
+        vector<thread> workers;
+        for (size_t i = 0; i < workerCount; i++)
+            workers.emplace_back([this]
+                                 { workerLoop(); });
+        cout << "Serving JSON-RPC on " << socketPath << " with " << workerCount << " workers" << endl;
+
+        bool signalled = false;
+        vector<pollfd> polled;
+        while (!signalled)
         {
-            for (const auto &[date, profileJson] : j["dailyProfiles"].items())
+            polled.assign({{wakeFds[0], POLLIN, 0}, {listenFd, POLLIN, 0}});
             {
-                profile.dailyProfiles[date] = DailyProfile::fromJson(profileJson);
+                lock_guard<mutex> guard(lock);
+                for (auto it = connections.begin(); it != connections.end();)
+                {
+                    Connection &connection = it->second;
+                    if (connection.hangup && !connection.busy)
+                    {
+                        ::close(connection.fd);
+                        it = connections.erase(it);
+                        continue;
+                    }
+                    if (!connection.hangup)
+                        polled.push_back({connection.fd, POLLIN, 0});
+                    ++it;
+                }
+            }
+
+            if (::poll(polled.data(), polled.size(), -1) < 0 && errno != EINTR)
+                break;
+
+            if (polled[0].revents & POLLIN)
+            {
+                char bytes[64];
+                while (::read(wakeFds[0], bytes, sizeof(bytes)) > 0)
+                {
+                }
+                signalled = stopRequested != 0;
+            }
+            if (polled[1].revents & POLLIN)
+            {
+                int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd >= 0)
+                {
+                    lock_guard<mutex> guard(lock);
+                    connections[fd].fd = fd;
+                }
+            }
+            lock_guard<mutex> guard(lock);
+            for (size_t i = 2; i < polled.size(); i++)
+            {
+                if (polled[i].revents & (POLLIN | POLLHUP | POLLERR))
+                    readFrom(connections[polled[i].fd]);
             }
         }
 
-        return profile;
+        cout << "Shutting down RPC server" << endl;
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        jobReady.notify_all();
+        for (thread &worker : workers)
+            worker.join();
+        for (auto &[fd, connection] : connections)
+            ::close(fd);
+        connections.clear();
+        ::close(listenFd);
+        ::close(wakeFds[0]);
+        ::close(wakeFds[1]);
+        ::unlink(socketPath.c_str());
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        return true;
     }
 };
 
-// Class to manage the user's profile and goals
-class ProfileManager
+int RpcServer::wakeFds[2] = {-1, -1};
+volatile sig_atomic_t RpcServer::stopRequested = 0;
+thread_local map<string, shared_ptr<UserShard>> RpcServer::touchedUsers;
+
+// Load generator for the RPC server. Each client connection works on its own
+// user (bench-0, bench-1, ...) and sends its share of the requests in windows
+// of `pipeline` requests: searches, logs spread over the last month, daily
+// totals and deletes of entries it logged. Reports throughput, latency
+// percentiles and error responses.
+class RpcLoadGenerator
 {
 private:
-    UserProfile userProfile;
-    FoodDiary& foodDiary;
-    string profileFilePath;
-
-    string getActivityLevelString(ActivityLevel level) const
+    static int connectTo(const string &socketPath)
     {
-        switch (level)
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
         {
-        case ActivityLevel::SEDENTARY:
-            return "Sedentary";
-        case ActivityLevel::LIGHTLY_ACTIVE:
-            return "Lightly Active";
-        case ActivityLevel::MODERATELY_ACTIVE:
-            return "Moderately Active";
-        case ActivityLevel::VERY_ACTIVE:
-            return "Very Active";
-        case ActivityLevel::EXTREMELY_ACTIVE:
-            return "Extremely Active";
-        default:
-            return "Unknown";
+            ::close(fd);
+            return -1;
         }
+        return fd;
     }
 
-    string getGenderString(Gender gender) const
+    static bool sendAll(int fd, const string &data)
     {
-        switch (gender)
+        size_t sent = 0;
+        while (sent < data.size())
         {
-        case Gender::MALE:
-            return "Male";
-        case Gender::FEMALE:
-            return "Female";
-        case Gender::OTHER:
-            return "Other";
-        default:
-            return "Unknown";
+            ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                return false;
+            sent += static_cast<size_t>(n);
         }
+        return true;
     }
 
-    string getCalculationMethodString(CalorieCalculationMethod method) const
+    static bool readLine(int fd, string &buffer, string &line)
     {
-        switch (method)
+        size_t newline;
+        while ((newline = buffer.find('\n')) == string::npos)
         {
-        case CalorieCalculationMethod::HARRIS_BENEDICT:
-            return "Harris-Benedict";
-        case CalorieCalculationMethod::MIFFLIN_ST_JEOR:
-            return "Mifflin-St Jeor";
-        default:
-            return "Unknown";
+            char chunk[65536];
+            ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0)
+                return false;
+            buffer.append(chunk, static_cast<size_t>(n));
         }
+        line.assign(buffer, 0, newline);
+        buffer.erase(0, newline + 1);
+        return true;
     }
 
-public:
-    ProfileManager(FoodDiary &fd, const string &profileFile)
-        : foodDiary(fd), profileFilePath(profileFile)
+    // One client's share of the load; returns false if the connection failed
+    static bool runClient(const string &socketPath, int client, long share, int pipeline,
+                          vector<double> &latencies, long &errors)
     {
-        loadProfile();
-    }
+        static const char *keywords[] = {"healthy", "bread", "chicken", "cheese", "apple"};
+        int fd = connectTo(socketPath);
+        if (fd < 0)
+            return false;
 
-    ~ProfileManager()
-    {
-        saveProfile();
-    }
+        string user = "bench-" + to_string(client);
+        string buffer, line;
+        vector<string> foods;
+        vector<size_t> logged(30, 0); // entries this client added per day, newest first
+        vector<size_t> loggedDays;    // days with entries, in no particular order
+        Date today = Date::today();
+        mt19937 rng(client);
+        latencies.reserve(share);
 
-    // Load profile from file
-    void loadProfile()
-    {
-        try
+        for (long sent = 0; sent < share;)
         {
-            ifstream file(profileFilePath);
-            if (!file.is_open())
+            string window;
+            int count = 0;
+            while (count < pipeline && sent < share)
             {
-                cout << "No existing profile found. Starting with default profile." << endl;
-                return;
+                int pick = rng() % 10;
+                json params = {{"user", user}};
+                string method;
+                if (pick < 5 || foods.empty())
+                {
+                    method = "catalog.search";
+                    params["keywords"] = {keywords[rng() % 5]};
+                    params["limit"] = 20;
+                }
+                else if (pick < 8 || loggedDays.empty())
+                {
+                    size_t day = rng() % logged.size();
+                    method = "diary.log";
+                    params["food"] = foods[rng() % foods.size()];
+                    params["date"] = (today - static_cast<int>(day)).toString();
+                    if (logged[day]++ == 0)
+                        loggedDays.push_back(day);
+                }
+                else if (pick < 9)
+                {
+                    method = "diary.totals";
+                }
+                else
+                {
+                    size_t slot = rng() % loggedDays.size();
+                    size_t day = loggedDays[slot];
+                    method = "diary.delete";
+                    params["date"] = (today - static_cast<int>(day)).toString();
+                    params["index"] = --logged[day];
+                    if (logged[day] == 0)
+                    {
+                        loggedDays[slot] = loggedDays.back();
+                        loggedDays.pop_back();
+                    }
+                }
+                window += json{{"jsonrpc", "2.0"}, {"id", sent}, {"method", method}, {"params", params}}.dump();
+                window += '\n';
+                count++;
+                sent++;
+                if (foods.empty())
+                    break; // learn some food names before logging
             }
 
-            json j;
-            file >> j;
-            userProfile = UserProfile::fromJson(j);
-
-            cout << "Profile loaded successfully." << endl;
-        }
-        catch (const exception &e)
-        {
-            cout << "Error loading profile: " << e.what() << endl;
+            auto sentAt = chrono::steady_clock::now();
+            if (!sendAll(fd, window))
+            {
+                ::close(fd);
+                return false;
+            }
+            for (int i = 0; i < count; i++)
+            {
+                if (!readLine(fd, buffer, line))
+                {
+                    ::close(fd);
+                    return false;
+                }
+                latencies.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - sentAt).count());
+                json reply = json::parse(line, nullptr, false);
+                if (reply.is_discarded() || reply.contains("error"))
+                {
+                    errors++;
+                }
+                else if (foods.empty() && reply["result"].contains("foods"))
+                {
+                    for (const json &food : reply["result"]["foods"])
+                        foods.push_back(food["name"].get<string>());
+                }
+            }
         }
+        ::close(fd);
+        return true;
     }
 
-    // Save profile to file
-    void saveProfile()
+public:
+    static int run(const string &socketPath, int clients, long requests, int pipeline)
     {
-        try
+        clients = max(1, clients);
+        pipeline = max(1, pipeline);
+        vector<vector<double>> latencies(clients);
+        vector<long> errors(clients, 0);
+        atomic<bool> failed{false};
+
+        auto start = chrono::steady_clock::now();
+        vector<thread> threads;
+        for (int c = 0; c < clients; c++)
         {
-            json j = userProfile.toJson();
-
-            ofstream file(profileFilePath);
-            file << j.dump(2);
-            cout << "Profile saved successfully." << endl;
+            long share = requests / clients + (c < requests % clients);
+            threads.emplace_back([&, c, share]
+                                 {
+                                     if (!runClient(socketPath, c, share, pipeline, latencies[c], errors[c]))
+                                         failed = true; });
         }
-        catch (const exception &e)
+        for (thread &t : threads)
+            t.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        if (failed)
         {
-            cout << "Error saving profile: " << e.what() << endl;
+            cerr << "Error: lost connection to " << socketPath << endl;
         }
-    }
-
-    // Display user profile
-    void displayUserProfile(const string &date)
-    {
-        DailyProfile dailyProfile = userProfile.getDailyProfile(date);
-        cout << "\n===== User Profile for " << date << "=====" << endl;
-        cout << "Gender: " << getGenderString(userProfile.getGender()) << endl;
-        cout << "Height: " << userProfile.getHeight() << " cm" << endl;
-        cout << "Age: " << userProfile.getAge() << " years" << endl;
-        cout << "Calorie calculation method: " << getCalculationMethodString(userProfile.getCalculationMethod()) << endl;
-        cout << "Weight: " << dailyProfile.getWeight() << " kg" << endl;
-        cout << "Activity Level: " << getActivityLevelString(dailyProfile.getActivityLevel()) << endl;
-
-        // Calculate and display calorie goal
-        double calorieTarget = userProfile.calculateDailyCalorieTarget(date);
-        cout << "Daily Calorie Target: " << calorieTarget << " calories" << endl;
-        cout << "=============================" << endl;
-    }
-
-    // Display daily profile for a specific date
-    void displayDailyProfile(const string &date)
-    {
-        DailyProfile dailyProfile = userProfile.getDailyProfile(date);
-
-        cout << "\n===== Daily Profile for " << date << " =====" << endl;
-        cout << "Weight: " << dailyProfile.getWeight() << " kg" << endl;
-        cout << "Activity Level: " << getActivityLevelString(dailyProfile.getActivityLevel()) << endl;
-
-        // Calculate and display calorie goal
-        double calorieTarget = userProfile.calculateDailyCalorieTarget(date);
-        cout << "Daily Calorie Target: " << calorieTarget << " calories" << endl;
-    }
-
-    // Calculate and display calorie summary for a date
-    void displayCalorieSummary(const string &date)
-    {
-        // Get calorie target
-        double calorieTarget = userProfile.calculateDailyCalorieTarget(date);
-
-        // Calculate consumed calories
-        double consumedCalories = 0.0;
-
-        // This assumes your LogManager class has a method to get the total calories for a date
-        // Modify this part based on your LogManager implementation
-        consumedCalories = foodDiary.getTotalCaloriesForDate(date);
-
-        // Calculate difference
-        double calorieDifference = consumedCalories - calorieTarget;
-
-        cout << "\n===== Calorie Summary for " << date << " =====" << endl;
-        cout << "Target: " << calorieTarget << " calories" << endl;
-        cout << "Consumed: " << consumedCalories << " calories" << endl;
-
-        if (calorieDifference < 0)
+        vector<double> all;
+        long errorCount = 0;
+        for (int c = 0; c < clients; c++)
         {
-            cout << "Remaining: " << -calorieDifference << " calories" << endl;
+            all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+            errorCount += errors[c];
         }
-        else
+        if (all.empty())
         {
-            cout << "Excess: " << calorieDifference << " calories" << endl;
+            return 1;
         }
+        sort(all.begin(), all.end());
+        auto percentile = [&](double q)
+        { return all[min(all.size() - 1, static_cast<size_t>(q * all.size()))]; };
+
+        cout << fixed << setprecision(1);
+        cout << all.size() << " requests from " << clients << " clients (pipeline " << pipeline << ") in "
+             << seconds << " s: " << all.size() / seconds << " requests/s" << endl;
+        cout << "Latency (us): p50 " << percentile(0.5) << ", p90 " << percentile(0.9) << ", p99 "
+             << percentile(0.99) << ", max " << all.back() << endl;
+        cout << "Error responses: " << errorCount << endl;
+        return failed ? 1 : 0;
     }
+};
 
-    // Update user profile
-    void updateUserProfile(const string &date)
-    {
-        cout << "\n===== Update User Profile for " << date << "=====" << endl;
-
-        cout << "Enter age: ";
-        int age;
-        cin >> age;
-        if (age < 0 || age > 1000) {
-            cout << "Invalid age. Please enter a valid age." << endl;
-            return;
-        }
-        
-        cout << "Enter weight (kg): ";
-        double weight;
-        cin >> weight;
-        if (weight <= 0) {
-            cout << "Invalid weight. Please enter a valid weight." << endl;
-            return;
-        }
-        
-        DailyProfile dailyProfile = userProfile.getDailyProfile(date);
-        
-        cout << "Select activity level (0 = Sedentary, 1 = Lightly Active, "
-        << "2 = Moderately Active, 3 = Very Active, 4 = Extremely Active): ";
-        int activityChoice;
-        cin >> activityChoice;
-        if (activityChoice < 0 || activityChoice > 4) {
-            cout << "Invalid activity level. Please select a valid option." << endl;
-            return;
-        }
-        
-        
-        userProfile.setAge(age);
-        dailyProfile.setWeight(weight);
-        dailyProfile.setActivityLevel(static_cast<ActivityLevel>(activityChoice));
-        userProfile.setDailyProfile(date, dailyProfile);
+// Round-trip checks of the diary's on-disk formats and recovery paths, run by
+// --selftest in a scratch directory that is removed afterwards. Prints one line
+// per check and returns the exit code: 0 when every check passed.
+class SelfTest
+{
+private:
+    string scratch;
+    ostream &out;
+    int failures = 0;
 
-        cout << "Select calorie calculation method (0 = Harris-Benedict, 1 = Mifflin-St Jeor): ";
-        int methodChoice;
-        cin >> methodChoice;
-        userProfile.setCalculationMethod(static_cast<CalorieCalculationMethod>(methodChoice));
+    SelfTest(string directory, ostream &report) : scratch(move(directory)), out(report) {}
 
-        cin.ignore();
+    void check(const string &name, bool passed)
+    {
+        out << (passed ? "ok      " : "FAILED  ") << name << endl;
+        if (!passed)
+            failures++;
     }
 
-    // Update daily profile for a specific date
-    void updateDailyProfile(const string &date)
+    static size_t recordCount(const string &journalPath)
     {
-        DailyProfile dailyProfile = userProfile.getDailyProfile(date);
+        return DiaryJournal::replay(journalPath, [](const json &) {});
+    }
 
-        cout << "\n===== Update Daily Profile for " << date << " =====" << endl;
+    // What a freshly opened diary sees between two dates
+    static CalorieRangeSummary reopened(FoodDatabaseManager &db, const string &logPath, Date from, Date to)
+    {
+        FoodDiary diary(db, logPath);
+        return diary.getCalorieSummaryForRange(from, to);
+    }
 
-        cout << "Enter weight (kg): ";
-        double weight;
-        cin >> weight;
-        dailyProfile.setWeight(weight);
+    void journalRotation()
+    {
+        string path = scratch + "/rotation.journal";
+        DiaryJournal journal(path);
+        journal.open();
+        journal.append(R"({"date":"2026-03-01","entries":[]})");
+        bool rotated = journal.rotate();
+        check("journal rotation moves the records aside",
+              rotated && recordCount(journal.getRotatedPath()) == 1 && recordCount(path) == 0);
+
+        journal.append(R"({"date":"2026-03-02","entries":[]})");
+        rotated = journal.rotate();
+        check("journal rotation appends to the leftovers of an unfinished compaction",
+              rotated && recordCount(journal.getRotatedPath()) == 2 && recordCount(path) == 0);
+
+        rotated = journal.rotate();
+        check("journal rotation of an empty journal keeps the leftovers",
+              rotated && recordCount(journal.getRotatedPath()) == 2);
+    }
 
-        cout << "Select activity level (0 = Sedentary, 1 = Lightly Active, "
-             << "2 = Moderately Active, 3 = Very Active, 4 = Extremely Active): ";
-        int activityChoice;
-        cin >> activityChoice;
-        dailyProfile.setActivityLevel(static_cast<ActivityLevel>(activityChoice));
+    void crashRecovery()
+    {
+        FoodDatabaseManager db(scratch + "/food_database.json");
+        db.addFood(make_shared<BasicFood>("Oats", vector<string>{"oats"}, 150.0f));
+        Date march = Date::fromCivil(2026, 3, 1);
+        Date april = Date::fromCivil(2026, 4, 2);
+
+        // A crash leaves the files as they stand while the diary is still open
+        string live = scratch + "/live", crashed = scratch + "/crashed", leftover = scratch + "/leftover";
+        filesystem::create_directories(live);
+        {
+            FoodDiary diary(db, live + "/food_log.json");
+            diary.logFood(march, "Oats", 1.0);
+            diary.logFood(march, "Oats", 2.0);
+            diary.logFood(april, "Oats", 1.0);
+            filesystem::copy(live, crashed, filesystem::copy_options::recursive);
+        }
+        // with the last record torn halfway through its write
+        ofstream(crashed + "/food_log/changes.journal", ios::app) << R"({"date":"2026-04-0)";
+        filesystem::copy(crashed, leftover, filesystem::copy_options::recursive);
 
-        userProfile.setDailyProfile(date, dailyProfile);
+        CalorieRangeSummary replayed = reopened(db, crashed + "/food_log.json", march, april);
+        check("journal replay after a crash", replayed.total == 600.0 && replayed.loggedDays == 2);
 
-        cin.ignore();
+        // The same crash, after a compaction had rotated the journal but not finished
+        filesystem::rename(leftover + "/food_log/changes.journal", leftover + "/food_log/changes.journal.compacting");
+        {
+            FoodDiary diary(db, leftover + "/food_log.json");
+            diary.logFood(april, "Oats", 1.0);
+            diary.saveLogs(true);
+        }
+        CalorieRangeSummary recovered = reopened(db, leftover + "/food_log.json", march, april);
+        check("recovery from a leftover .journal.compacting",
+              recovered.total == 750.0 && recovered.loggedDays == 2 &&
+                  !filesystem::exists(leftover + "/food_log/changes.journal.compacting") &&
+                  recordCount(leftover + "/food_log/changes.journal") == 0);
+
+        // A torn record must not swallow the first record written after it
+        string torn = scratch + "/torn";
+        filesystem::create_directories(torn + "/food_log");
+        ofstream(torn + "/food_log/changes.journal") << R"({"date":"2026-03-0)";
+        {
+            FoodDiary diary(db, torn + "/food_log.json");
+            diary.logFood(march, "Oats", 1.0);
+        }
+        CalorieRangeSummary appended = reopened(db, torn + "/food_log.json", march, april);
+        check("journal record after a torn one survives replay", appended.total == 150.0 && appended.loggedDays == 1);
     }
 
-    // Change calculation method
-    void changeCalculationMethod()
+    void columnarRoundTrip()
     {
-        cout << "\n===== Change Calculation Method =====" << endl;
-        cout << "Current method: " << getCalculationMethodString(userProfile.getCalculationMethod()) << endl;
-        cout << "Available methods:" << endl;
-        cout << "0 - Harris-Benedict" << endl;
-        cout << "1 - Mifflin-St Jeor" << endl;
-        cout << "Select method: ";
+        using Type = ColumnarWriter::ColumnType;
+        string path = scratch + "/roundtrip.dcol";
+        vector<json> rows = {
+            {20514, "Oats", 150.0, "breakfast"},
+            {20514, "Apple", 1.0 / 3.0, ""},
+            {20513, "Oats", -2.5, "late"},
+            {20600, "Rice, white", 1e300, "tab\there"},
+            {20600, "Apple", 0.001, "last"}};
+        {
+            // Two rows per block, so dictionary ids and deltas span blocks
+            ColumnarWriter writer(path, {{"date", Type::DAY}, {"food", Type::DICTIONARY},
+                                         {"calories", Type::DOUBLE}, {"note", Type::STRING}},
+                                  2);
+            for (const json &row : rows)
+            {
+                writer.add(0, row[0].get<int32_t>());
+                writer.add(1, row[1].get<string>());
+                writer.add(2, row[2].get<double>());
+                writer.add(3, row[3].get<string>());
+                writer.endRow();
+            }
+            writer.close();
+        }
 
-        int methodChoice;
-        cin >> methodChoice;
-        userProfile.setCalculationMethod(static_cast<CalorieCalculationMethod>(methodChoice));
+        ColumnarReader reader(path);
+        vector<json> read, block;
+        while (reader.readBlock(block))
+            move(block.begin(), block.end(), back_inserter(read));
+        check(".dcol columnar writer round trip",
+              reader.isValid() && reader.columnNames() == vector<string>{"date", "food", "calories", "note"} &&
+                  read == rows);
+    }
 
-        cout << "Calculation method changed to "
-             << getCalculationMethodString(userProfile.getCalculationMethod()) << endl;
+    void slotReuse()
+    {
+        DiaryColumnStore store;
+        Date day = Date::fromCivil(2026, 3, 1);
+        uint32_t oats = store.internFood("Oats");
+        EntryId removed = store.append(day, oats, 1.0, 150.0);
+        EntryId kept = store.append(day, oats, 3.0, 450.0);
+        store.remove(removed);
+        store.purgeDay(day, [](EntryId)
+                       { return false; });
+        EntryId reused = store.append(day, oats, 2.0, 300.0);
+
+        size_t position = store.positionOf(reused);
+        check("slot map reuses a freed slot under a new generation",
+              reused.index == removed.index && reused.generation != removed.generation &&
+                  store.positionOf(removed) == DiaryColumnStore::npos && !store.restore(removed) &&
+                  position != DiaryColumnStore::npos && store.servingsAt(position) == 2.0 &&
+                  store.positionOf(kept) != DiaryColumnStore::npos && store.servingsAt(store.positionOf(kept)) == 3.0);
+    }
 
-        cin.ignore();
+public:
+    static int run()
+    {
+        string pattern = (filesystem::temp_directory_path() / "food-selftest-XXXXXX").string();
+        if (!mkdtemp(&pattern[0]))
+        {
+            cerr << "Unable to create a scratch directory for the self-test." << endl;
+            return 1;
+        }
+
+        // The stores report loads and saves on cout; only the checks are shown
+        ostream report(cout.rdbuf());
+        ostringstream chatter;
+        streambuf *console = cout.rdbuf(chatter.rdbuf());
+        SelfTest test(pattern, report);
+        try
+        {
+            test.journalRotation();
+            test.crashRecovery();
+            test.columnarRoundTrip();
+            test.slotReuse();
+        }
+        catch (const exception &e)
+        {
+            test.check(string("self-test aborted: ") + e.what(), false);
+        }
+        cout.rdbuf(console);
+
+        error_code ec;
+        filesystem::remove_all(pattern, ec);
+        report << (test.failures ? to_string(test.failures) + " check(s) failed." : string("All checks passed.")) << endl;
+        return test.failures ? 1 : 0;
     }
 };
 
-
 // Command Line Interface class
 class DietAssistantCLI
 {
 private:
     FoodDatabaseManager dbManager;
-    FoodDiary foodDiary;
-    ProfileManager profileManager;
+    UserRegistry users;
+    UserRegistry::Lease currentUser; // held for the whole session of the signed-in user
     bool running;
+    OutputFormat outputFormat = OutputFormat::TABLE; // for listings: foods, searches, the day's log
+
+    // Held while a menu command runs, so the autosaver saves between commands
+    mutex sessionLock;
+    unique_ptr<Autosaver> autosaver; // declared after the stores it saves
+
+    FoodDiary &diary() { return currentUser.diary(); }
+    ProfileManager &profiles() { return currentUser.profiles(); }
 
     void displayMenu()
     {
@@ -1528,9 +7982,19 @@ private:
         cout << "14. Update User Profile\n";
         cout << "15. Change calorie calculation method\n";
         cout << "16. View Calorie summary\n";
-        cout << "17. Exit\n";
+        cout << "17. Intake reports (week/month/year/range)\n";
+        cout << "18. Redo Last Undone Action\n";
+        cout << "19. View Undo/Redo History\n";
+        cout << "20. Import diary entries from file\n";
+        cout << "21. Export diary or catalog\n";
+        cout << "22. Switch user (current: " << currentUser.userId() << ")\n";
+        cout << "23. Edit basic food calories\n";
+        cout << "24. Weight and intake trends\n";
+        cout << "25. Weight forecast\n";
+        cout << "26. Performance stats\n";
+        cout << "27. Exit\n";
         cout << "==============================\n";
-        cout << "Enter choice (1-17): ";
+        cout << "Enter choice (1-27): ";
     }
 
     void searchFoods()
@@ -1565,11 +8029,39 @@ private:
             cin >> matchChoice;
 
             bool matchAll = (matchChoice == 1);
-            auto vec = dbManager.searchFoodsByKeywords(keywords, matchAll);
-            for (const auto &food : vec)
+
+            cout << "Filter by calorie range? (yes/no): ";
+            string rangeChoice;
+            cin >> rangeChoice;
+
+            if (rangeChoice == "yes")
+            {
+                float minCalories, maxCalories;
+                cout << "Enter minimum calories: ";
+                cin >> minCalories;
+                cout << "Enter maximum calories: ";
+                cin >> maxCalories;
+                if (!cin || !(minCalories <= maxCalories))
+                {
+                    cin.clear();
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    cout << "Invalid calorie range: the minimum must not exceed the maximum." << endl;
+                    return;
+                }
+                FoodDatabaseManager::listFoods(dbManager.queryFoods(keywords, matchAll, minCalories, maxCalories),
+                                               outputFormat);
+            }
+            else
+            {
+                FoodDatabaseManager::listFoods(dbManager.queryFoods(keywords, matchAll), outputFormat);
+            }
+
+            cout << "Explain query plan? (yes/no): ";
+            string explainChoice;
+            cin >> explainChoice;
+            if (explainChoice == "yes")
             {
-                cout << food->getName() << " (" << food->getType() << ") - "
-                     << food->getCalories() << " calories" << endl;
+                dbManager.explainSearch(keywords, matchAll);
             }
         }
         else
@@ -1583,7 +8075,7 @@ private:
             if (food)
             {
                 cout << "\n=== Food Details ===" << endl;
-                food->display();
+                food->display(outputFormat);
             }
             else
             {
@@ -1603,7 +8095,7 @@ private:
         if (food)
         {
             cout << "\n=== Food Details ===" << endl;
-            food->display();
+            food->display(outputFormat);
         }
         else
         {
@@ -1611,6 +8103,41 @@ private:
         }
     }
 
+    // Changes a basic food's calories and reprices the past entries it affects
+    void editFoodCalories()
+    {
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+
+        cout << "\n=== Edit Basic Food Calories ===" << endl;
+        cout << "Enter food name: ";
+        string name;
+        getline(cin, name);
+
+        cout << "Enter new calories per serving: ";
+        float calories;
+        if (!(cin >> calories) || calories < 0)
+        {
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid calories." << endl;
+            return;
+        }
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+
+        map<string, double> changed = dbManager.setBasicFoodCalories(name, calories);
+        if (changed.empty())
+            return;
+        cout << "Updated " << changed.size() << " food(s) in the database." << endl;
+        diary().startRepricing(changed);
+
+        // The catalog is shared, so every other user's history is stale too
+        size_t others = users.repriceOtherUsers(currentUser.userId(), changed);
+        if (others > 0)
+        {
+            cout << "Re-pricing the diaries of " << others << " other user(s) in the background." << endl;
+        }
+    }
+
     void addBasicFood()
     {
         string name;
@@ -1737,6 +8264,84 @@ private:
         }
     }
 
+    void exportData()
+    {
+        cout << "\nExport:\n";
+        cout << "1. Diary entries\n";
+        cout << "2. Food catalog\n";
+        cout << "Choice: ";
+        int choice;
+        cin >> choice;
+        cin.ignore();
+        if (choice != 1 && choice != 2)
+        {
+            cout << "Invalid choice." << endl;
+            return;
+        }
+
+        cout << "Enter output path (.csv for CSV, anything else for columnar): ";
+        string path;
+        getline(cin >> ws, path);
+
+        if (choice == 2)
+        {
+            dbManager.exportCatalog(path);
+            return;
+        }
+
+        Date fromDate = Date::fromCivil(1, 1, 1);
+        Date toDate = Date::fromCivil(9999, 12, 31);
+        cout << "Export all dates? (yes/no): ";
+        string all;
+        cin >> all;
+        cin.ignore();
+        if (all != "yes")
+        {
+            string from, to;
+            cout << "Enter start date (YYYY-MM-DD): ";
+            cin >> from;
+            cout << "Enter end date (YYYY-MM-DD): ";
+            cin >> to;
+            cin.ignore();
+            if (!Date::parse(from, fromDate) || !Date::parse(to, toDate) || fromDate > toDate)
+            {
+                cout << "Invalid date range." << endl;
+                return;
+            }
+        }
+        diary().exportEntries(path, fromDate, toDate);
+    }
+
+    void switchUser()
+    {
+        cout << "Enter user id: ";
+        string userId;
+        cin >> userId;
+        cin.ignore();
+        if (!UserRegistry::isValidUserId(userId))
+        {
+            cout << "Invalid user id. Use letters, digits, '.', '_' or '-'." << endl;
+            return;
+        }
+
+        // Release the current user first so its shard may be evicted
+        unwatchUser();
+        currentUser = UserRegistry::Lease();
+        currentUser = users.acquire(userId);
+        watchUser();
+        cout << "Signed in as " << userId << "." << endl;
+    }
+
+    void showStats()
+    {
+        if (!Instrumentation::isEnabled())
+        {
+            cout << "Performance stats are off. Start the program with --stats to collect them." << endl;
+            return;
+        }
+        Instrumentation::report(outputFormat);
+    }
+
     void handleExit()
     {
         if (dbManager.isModified())
@@ -1756,24 +8361,156 @@ private:
 
 public:
     DietAssistantCLI(const string &databasePath = "food_database.json", const string &logPath = "food_log.json", const string &profilePath = "user_profile.json")
-        : dbManager(databasePath), foodDiary(dbManager, logPath), profileManager(foodDiary, profilePath), running(false)
+        : dbManager(databasePath), users(dbManager, "user", logPath, profilePath), running(false)
+    {
+        currentUser = users.acquire("user");
+    }
+
+    void setOutputFormat(OutputFormat format) { outputFormat = format; }
+
+    // Saves the catalog, diary and profile in the background once edits pause for
+    // interval, and at most maxStale after an unsaved edit, while the menu is idle
+    void enableAutosave(chrono::milliseconds interval, chrono::milliseconds maxStale)
+    {
+        autosaver = make_unique<Autosaver>([this](const function<void()> &save)
+                                           {
+                                               lock_guard<mutex> session(sessionLock);
+                                               save(); },
+                                           interval, maxStale);
+    }
+
+    // The diary and profile targets follow the signed-in user
+    void watchStores()
+    {
+        if (!autosaver)
+            return;
+        autosaver->watch("catalog", dbManager.dirtyTracker(), [this]
+                         { dbManager.saveDatabase(true); });
+        watchUser();
+    }
+
+    void watchUser()
+    {
+        if (!autosaver)
+            return;
+        autosaver->watch("diary", diary().dirtyTracker(), [this]
+                         { diary().saveLogs(true); });
+        autosaver->watch("profile", profiles().dirtyTracker(), [this]
+                         { profiles().saveProfile(true); });
+    }
+
+    void unwatchUser()
+    {
+        if (!autosaver)
+            return;
+        autosaver->unwatch(diary().dirtyTracker());
+        autosaver->unwatch(profiles().dirtyTracker());
+    }
+
+    // Carries out one scripted command and returns its response fields. Failures
+    // throw and become {"ok": false, "error": ...}.
+    json runScriptCommand(const json &command)
+    {
+        string op = command.at("op").get<string>();
+        if (op == "add_food")
+            return DietRequests::addFood(dbManager, command);
+        if (op == "log")
+            return DietRequests::logFood(diary(), command);
+        if (op == "delete")
+            return DietRequests::deleteEntry(diary(), command);
+        if (op == "search")
+            return DietRequests::searchFoods(dbManager, command);
+        if (op == "summary")
+            return DietRequests::daySummary(diary(), profiles(), command);
+        throw invalid_argument("unknown op: " + op);
+    }
+
+    // Script mode: one JSON command per input line (add_food, log, delete, search,
+    // summary) and one JSON response per line on out, echoing the command's "id".
+    // Nothing prompts; responses collect in a buffer written out in large blocks,
+    // and the diary journal is synced once per block, before the responses that
+    // acknowledge its changes. Returns the number of failed commands.
+    size_t runScript(istream &in, ostream &out)
     {
+        dbManager.loadDatabase();
+        diary().setGroupCommit(true);
+
+        static const size_t flushBytes = 1 << 16;
+        string buffer;
+        buffer.reserve(flushBytes + 4096);
+        size_t lineNumber = 0, failures = 0;
+        string line;
+        while (getline(in, line))
+        {
+            lineNumber++;
+            if (line.find_first_not_of(" \t\r") == string::npos)
+                continue;
+
+            json response;
+            json command;
+            try
+            {
+                command = json::parse(line);
+                response = runScriptCommand(command);
+                response["ok"] = true;
+            }
+            catch (const exception &e)
+            {
+                response = {{"ok", false}, {"error", e.what()}, {"line", lineNumber}};
+                failures++;
+            }
+            if (command.is_object() && command.contains("id"))
+            {
+                response["id"] = command["id"];
+            }
+
+            buffer += response.dump();
+            buffer += '\n';
+            if (buffer.size() >= flushBytes)
+            {
+                diary().commitJournal();
+                out.write(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+        }
+        diary().setGroupCommit(false);
+        out.write(buffer.data(), buffer.size());
+        out.flush();
+
+        if (dbManager.isModified())
+        {
+            dbManager.saveDatabase();
+        }
+        return failures;
     }
 
     void start()
     {
         running = true;
-        dbManager.loadDatabase();
+        {
+            lock_guard<mutex> session(sessionLock);
+            dbManager.loadDatabase();
+            watchStores();
+        }
 
         cout << "Welcome to Diet Assistant!" << endl;
 
         while (running)
         {
-            displayMenu();
+            {
+                lock_guard<mutex> session(sessionLock);
+                diary().pollRepricing();
+                if (size_t others = users.takeRepricedUsers())
+                {
+                    cout << "Re-priced the diaries of " << others << " other user(s)." << endl;
+                }
+                displayMenu();
+            }
 
             int choice;
             cin >> choice;
 
+            lock_guard<mutex> session(sessionLock);
             switch (choice)
             {
             case 1:
@@ -1789,43 +8526,73 @@ public:
                 createCompositeFood();
                 break;
             case 5:
-                dbManager.listAllFoods();
+                dbManager.listAllFoods(outputFormat);
                 break;
             case 6:
                 dbManager.saveDatabase();
                 break;
             case 7:
-                foodDiary.displayDailyLog(foodDiary.getCurrentDate());
+                diary().displayDailyLog(diary().getCurrentDate(), outputFormat);
                 break;
             case 8:
-                foodDiary.addFoodToLog();
+                diary().addFoodToLog();
                 break;
             case 9:
-                foodDiary.deleteFoodFromLog();
+                diary().deleteFoodFromLog();
                 break;
             case 10:
-                foodDiary.changeDate();
+                diary().changeDate();
                 break;
             case 11:
                 // should undo
-                foodDiary.undo();
+                diary().undo();
                 break;
             case 12:
-                foodDiary.changeDate();
+                diary().changeDate();
                 break;
             case 13:
-                profileManager.displayUserProfile(foodDiary.getCurrentDate());
+                profiles().displayUserProfile(diary().getCurrentDate());
                 break;
             case 14:
-                profileManager.updateUserProfile(foodDiary.getCurrentDate());
+                profiles().updateUserProfile(diary().getCurrentDate());
                 break;
             case 15:
-                profileManager.changeCalculationMethod();
+                profiles().changeCalculationMethod();
                 break;
             case 16:
-                profileManager.displayCalorieSummary(foodDiary.getCurrentDate());
+                profiles().displayCalorieSummary(diary().getCurrentDate());
                 break;
             case 17:
+                diary().showIntakeReports();
+                break;
+            case 18:
+                diary().redo();
+                break;
+            case 19:
+                diary().showUndoStack();
+                break;
+            case 20:
+                diary().importEntriesFromFile();
+                break;
+            case 21:
+                exportData();
+                break;
+            case 22:
+                switchUser();
+                break;
+            case 23:
+                editFoodCalories();
+                break;
+            case 24:
+                profiles().displayTrends(diary().getCurrentDate());
+                break;
+            case 25:
+                profiles().displayWeightForecast(diary().getCurrentDate());
+                break;
+            case 26:
+                showStats();
+                break;
+            case 27:
                 handleExit();
                 break;
             default:
@@ -1833,13 +8600,189 @@ public:
             }
         }
 
+        autosaver.reset();
         cout << "Thank you for using Diet Assistant. Goodbye!" << endl;
     }
 };
 
-int main()
+int main(int argc, char *argv[])
 {
-    DietAssistantCLI dietAssistant;
-    dietAssistant.start();
-    return 0;
+    // --script FILE (or - for stdin) runs JSONL commands instead of the menu;
+    // --serve SOCKET runs the JSON-RPC server and --bench SOCKET load-tests one.
+    // --format=tsv|json prints menu listings for scripts to consume.
+    // --stats times loads, saves and searches and prints a summary at exit.
+    // --selftest checks the diary's file formats and crash recovery, then exits.
+    string scriptPath, servePath, benchPath;
+    OutputFormat format = OutputFormat::TABLE;
+    int workers = static_cast<int>(max(2u, thread::hardware_concurrency()));
+    int clients = 8;
+    long requests = 100000;
+    int pipeline = 1;
+    long autosaveInterval = 2000, autosaveMaxStale = 30000; // ms; an interval of 0 turns autosave off
+    bool collectStats = false;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--script" && i + 1 < argc)
+        {
+            scriptPath = argv[++i];
+        }
+        else if (arg == "--serve" && i + 1 < argc)
+        {
+            servePath = argv[++i];
+        }
+        else if (arg == "--bench" && i + 1 < argc)
+        {
+            benchPath = argv[++i];
+        }
+        else if (arg == "--workers" && i + 1 < argc)
+        {
+            workers = atoi(argv[++i]);
+        }
+        else if (arg == "--clients" && i + 1 < argc)
+        {
+            clients = atoi(argv[++i]);
+        }
+        else if (arg == "--requests" && i + 1 < argc)
+        {
+            requests = atol(argv[++i]);
+        }
+        else if (arg == "--pipeline" && i + 1 < argc)
+        {
+            pipeline = atoi(argv[++i]);
+        }
+        else if (arg == "--autosave-interval" && i + 1 < argc)
+        {
+            autosaveInterval = atol(argv[++i]);
+        }
+        else if (arg == "--autosave-max-stale" && i + 1 < argc)
+        {
+            autosaveMaxStale = atol(argv[++i]);
+        }
+        else if (arg == "--stats")
+        {
+            collectStats = true;
+        }
+        else if (arg == "--selftest")
+        {
+            return SelfTest::run();
+        }
+        else if (arg.rfind("--format=", 0) == 0)
+        {
+            if (!parseOutputFormat(arg.substr(9), format))
+            {
+                cerr << "Error: unknown format " << arg.substr(9) << ", expected table, tsv or json" << endl;
+                return 2;
+            }
+        }
+        else
+        {
+            cerr << "Usage: " << argv[0] << " [--format=table|tsv|json] [--autosave-interval MS] [--autosave-max-stale MS] [--stats]\n"
+                 << "       " << argv[0] << " --script FILE|- [--stats]\n"
+                 << "       " << argv[0] << " --serve SOCKET [--workers N] [--autosave-interval MS] [--autosave-max-stale MS] [--stats]\n"
+                 << "       " << argv[0] << " --bench SOCKET [--clients N] [--requests N] [--pipeline N]\n"
+                 << "       " << argv[0] << " --selftest" << endl;
+            return 2;
+        }
+    }
+
+    if (!benchPath.empty())
+    {
+        return RpcLoadGenerator::run(benchPath, clients, requests, pipeline);
+    }
+
+    // The summary goes to stderr once the stores are saved, so stdout keeps only listings
+    Instrumentation::enable(collectStats);
+    auto reportStats = [collectStats]
+    {
+        if (collectStats)
+            Instrumentation::report(OutputFormat::TABLE, cerr);
+    };
+
+    if (!servePath.empty())
+    {
+        FoodDatabaseManager dbManager;
+        dbManager.loadDatabase();
+        UserRegistry users(dbManager, "user", "food_log.json", "user_profile.json");
+
+        // Diaries are durable through their journals; the catalog autosaves
+        unique_ptr<Autosaver> autosaver;
+        if (autosaveInterval > 0)
+        {
+            autosaver = make_unique<Autosaver>([&users](const function<void()> &save)
+                                               { users.withCatalog([&](FoodDatabaseManager &)
+                                                                   { save(); }); },
+                                               chrono::milliseconds(autosaveInterval),
+                                               chrono::milliseconds(autosaveMaxStale));
+            users.withCatalog([&](FoodDatabaseManager &db)
+                              { autosaver->watch("catalog", db.dirtyTracker(), [&db]
+                                                 { db.saveDatabase(true); }); });
+        }
+
+        RpcServer server(users, servePath, static_cast<size_t>(max(1, workers)));
+        bool served = server.run();
+        autosaver.reset();
+
+        // Saving profiles and diaries happens as their shards are released
+        users.evictIdle();
+        if (dbManager.isModified())
+        {
+            dbManager.saveDatabase();
+        }
+        reportStats();
+        return served ? 0 : 1;
+    }
+
+    if (scriptPath.empty())
+    {
+        // With a machine format stdout carries only listings; prompts go to stderr
+        streambuf *console = cout.rdbuf();
+        ostream listings(console);
+        if (format != OutputFormat::TABLE)
+        {
+            cout.rdbuf(cerr.rdbuf());
+            ListingRenderer::setOutput(listings);
+        }
+        {
+            DietAssistantCLI dietAssistant;
+            dietAssistant.setOutputFormat(format);
+            if (autosaveInterval > 0)
+            {
+                dietAssistant.enableAutosave(chrono::milliseconds(autosaveInterval),
+                                             chrono::milliseconds(autosaveMaxStale));
+            }
+            dietAssistant.start();
+        }
+        ListingRenderer::setOutput(cout);
+        cout.rdbuf(console);
+        reportStats();
+        return 0;
+    }
+
+    ifstream file;
+    if (scriptPath != "-")
+    {
+        file.open(scriptPath);
+        if (!file)
+        {
+            cerr << "Error: cannot open script " << scriptPath << endl;
+            return 1;
+        }
+    }
+    else
+    {
+        ios::sync_with_stdio(false);
+    }
+
+    // Stdout carries only responses; status messages go to stderr
+    streambuf *console = cout.rdbuf(cerr.rdbuf());
+    ostream responses(console);
+    size_t failures;
+    {
+        DietAssistantCLI dietAssistant;
+        failures = dietAssistant.runScript(scriptPath == "-" ? cin : file, responses);
+    }
+    cout.rdbuf(console);
+    reportStats();
+    return failures ? 1 : 0;
 }
\ No newline at end of file